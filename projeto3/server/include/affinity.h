@@ -0,0 +1,30 @@
+#ifndef AFFINITY_H
+#define AFFINITY_H
+
+#include "board.h"
+
+#define AFFINITY_MAX_CPUS 1024
+
+/*
+Placement policy: with a core set, the n-th session thread, reactor worker or
+ghost pool helper is pinned to the n-th core of the set, round robin, and the
+boards of a session are moved to the NUMA node of the core that loads them.
+Without one every thread is left to the kernel.
+*/
+
+/*Parses a core list such as 0-3,8 into the set sessions are spread over, -1 if it is malformed*/
+int affinity_set_cpus(const char* list);
+
+/*Keeps the share of the core set of one of n_parts worker processes, every part gets at least one core*/
+void affinity_restrict(int part, int n_parts);
+
+/*Core of the index-th thread of the set, -1 when no core set was given*/
+int affinity_cpu(int index);
+
+/*Pins the calling thread to one core, does nothing for -1*/
+int affinity_pin(int cpu);
+
+/*Moves the arena blocks of a freshly loaded board to the NUMA node the calling thread runs on*/
+void affinity_bind_board(board_t* board);
+
+#endif
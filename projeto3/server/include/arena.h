@@ -0,0 +1,55 @@
+#ifndef ARENA_H
+#define ARENA_H
+
+#include <stddef.h>
+
+#define ARENA_BLOCK_SIZE (64 * 1024) // bytes of a block, bigger requests get a block of their own
+
+typedef struct arena_block arena_block_t;
+
+/*
+Bump allocator owned by one session. Everything carved from it is given
+back at once, by rewinding to a mark taken earlier or by a reset, and the
+blocks are kept for the allocations that follow, so a session that keeps
+playing stops calling malloc after its first levels.
+*/
+typedef struct {
+    arena_block_t* blocks; // in use, newest first
+    arena_block_t* spare; // given back, reused before asking malloc for more
+    size_t block_size;
+    size_t used; // bytes handed out and not given back
+    size_t peak; // most bytes handed out at once since the last reset
+} arena_t;
+
+/*Everything allocated after the mark was taken, see arena_rewind*/
+typedef struct {
+    arena_block_t* block;
+    size_t offset;
+    size_t used;
+} arena_mark_t;
+
+void arena_init(arena_t* arena, size_t block_size);
+
+/*size bytes aligned for any type, NULL if out of memory*/
+void* arena_alloc(arena_t* arena, size_t size);
+
+/*Same as arena_alloc, zeroed*/
+void* arena_calloc(arena_t* arena, size_t n, size_t size);
+
+char* arena_strdup(arena_t* arena, const char* string);
+
+arena_mark_t arena_mark(arena_t* arena);
+
+/*Gives back everything allocated since the mark was taken*/
+void arena_rewind(arena_t* arena, arena_mark_t mark);
+
+/*Calls visit on every block in use, each one whole pages that nothing outside the arena shares*/
+void arena_visit_blocks(arena_t* arena, void (*visit)(void* start, size_t size, void* arg), void* arg);
+
+/*Gives back everything, for the next session*/
+void arena_reset(arena_t* arena);
+
+/*Frees every block, the arena can't be used afterwards*/
+void arena_destroy(arena_t* arena);
+
+#endif
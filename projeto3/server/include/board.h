@@ -1,15 +1,54 @@
 #ifndef BOARD_H
 #define BOARD_H
 
-#define MAX_MOVES 20
 #define MAX_LEVELS 20
 #define MAX_FILENAME 256
-#define MAX_GHOSTS 25
+
+// reader slots of board_t::state_lock, one per thread playing a session
+#define READER_DISPLAY 0
+#define READER_PACMAN 1
+#define READER_GHOST(index) (2 + (index))
+#define STATE_LOCK_READERS(n_ghosts) (2 + (n_ghosts))
+
+// layout of board_pos_t::state, one byte per cell
+#define CELL_KIND 0x03u // what stands in the cell, one of the four below
+#define CELL_EMPTY 0u
+#define CELL_WALL 1u
+#define CELL_PACMAN 2u
+#define CELL_GHOST 3u
+#define CELL_DOT (1u << 2)
+#define CELL_PORTAL (1u << 3)
+#define CELL_FLAGS (CELL_DOT | CELL_PORTAL)
+#define CELL_CONTENTS " WPM" // content character of each kind
+#define CELL_GLYPHS " XCM.XCM@XCM.XCM" // character sent to the client for every state
+
+// bit layers, one bit per cell and every row (and column) starting on a new word
+// walls and portals never change and live in level_t::layers, the others in board_t::layers
+#define LAYER_WALLS 0
+#define LAYER_PORTALS 1
+#define N_STATIC_LAYERS 2
+#define LAYER_DOTS 2
+#define LAYER_GHOSTS 3
+#define LAYER_PACMAN 4
+#define N_LAYERS 5
+#define LAYER_WORD_BITS 64
+
+// board_t::passable bits, set when a single step that way stays on the board and off the walls
+#define PASS_UP (1u << 0)
+#define PASS_DOWN (1u << 1)
+#define PASS_LEFT (1u << 2)
+#define PASS_RIGHT (1u << 3)
 
 #include <pthread.h>
+#include <stdatomic.h>
 #include <stdbool.h>
+#include <time.h>
+#include "arena.h"
+#include "brlock.h"
+#include "rng.h"
 
 typedef enum {
+    LEVEL_CLEARED = 2, // the last dot was eaten
     REACHED_PORTAL = 1,
     VALID_MOVE = 0,
     INVALID_MOVE = -1,
@@ -22,12 +61,17 @@ typedef struct {
     int turns_left;
 } command_t;
 
+/*
+Entities are split in two: what every turn reads (position, counters and
+flags) stays in pacman_t and ghost_t, packed next to each other in the
+board arrays, while the move script and its rng, read once per move, live
+in a parallel array of script_t.
+*/
 typedef struct {
     int pos_x, pos_y; //current position
     int alive; // if is alive
     int points; // how many points have been collected
     int passo; // number of plays to wait before starting
-    command_t moves[MAX_MOVES];
     int current_move;
     int n_moves;
     int waiting;
@@ -36,7 +80,6 @@ typedef struct {
 typedef struct {
     int pos_x, pos_y; //current position
     int passo; // number of plays to wait before starting
-    command_t moves[MAX_MOVES];
     int n_moves;
     int current_move;
     int waiting;
@@ -44,27 +87,151 @@ typedef struct {
 } ghost_t;
 
 typedef struct {
-    char content; // stuff like 'P' for pacman 'M' for monster and 'W' for wall
-    int has_dot; // whether there is a dot in this position or not
-    int has_portal; // whether there is a portal in this position or not
-    pthread_mutex_t lock;
-} board_pos_t;
+    int first_move; // where the moves of the entity start in board_t::commands
+    rng_t rng; // 'R' moves, seeded by seed_level
+} script_t;
 
 typedef struct {
+    atomic_uchar state; // kind and flags packed in one byte, moves change it with compare-and-swap
+} board_pos_t;
+
+static inline unsigned char cell_kind(board_pos_t* pos) {
+    return atomic_load_explicit(&pos->state, memory_order_relaxed) & CELL_KIND;
+}
+
+/*'W', 'P', 'M' or ' '*/
+static inline char cell_content(board_pos_t* pos) {
+    return CELL_CONTENTS[cell_kind(pos)];
+}
+
+/*What the client is shown for the cell, 'X', 'C', 'M', '@', '.' or ' '*/
+static inline char cell_glyph(board_pos_t* pos) {
+    return CELL_GLYPHS[atomic_load_explicit(&pos->state, memory_order_relaxed)];
+}
+
+static inline bool cell_has_dot(board_pos_t* pos) {
+    return atomic_load_explicit(&pos->state, memory_order_relaxed) & CELL_DOT;
+}
+
+static inline bool cell_has_portal(board_pos_t* pos) {
+    return atomic_load_explicit(&pos->state, memory_order_relaxed) & CELL_PORTAL;
+}
+
+/*Puts an entity of the given kind in a cell while the level is loading, nobody else may be moving*/
+static inline void cell_place(board_pos_t* pos, unsigned char kind) {
+    unsigned char flags = atomic_load_explicit(&pos->state, memory_order_relaxed) & CELL_FLAGS;
+    atomic_store_explicit(&pos->state, flags | kind, memory_order_relaxed);
+}
+
+/*
+What every session playing a level shares: the walls and portals never
+move, so their layers and the passable masks are built once, along with
+the board the level starts as, which each session copies into its own.
+Read-only once built, freed with the last reference.
+*/
+typedef struct level {
+    atomic_int refs; // boards playing it, plus one for the catalog holding it
+    char* path; // file it was parsed from
+    char* name; // level file name without the extension
+    char* pacman_file; // file with pacman movements, NULL when the client plays it
+    char** ghosts_files; // files with monster movements, one per ghost of the start, NULL terminated
+    atomic_ullong* layers; // N_STATIC_LAYERS, laid out like board_t::layers
+    unsigned char* passable; // PASS_* bits of each cell
+    struct board* start; // the level as parsed, NULL for a board restored from another server
+    void* map; // compiled level file the arrays above point into, NULL for a level parsed from text
+    size_t map_size;
+} level_t;
+
+typedef struct board {
     int width, height; //dimensions of the board
     board_pos_t* board; //actual board, most likely a row-major matrix
     int n_pacmans; //number of pacmans in the board
     pacman_t* pacmans; // array containing every pacman in the board to iterate through when processing
     int n_ghosts; //number of ghosts in the board
     ghost_t* ghosts; // array containing every ghost in the board to iterate through when processing
-    char level_name[256]; //name for the level file to keep track of which will be the next
-    char pacman_file[256]; // file with pacman movements
-    char ghosts_files[MAX_GHOSTS][256]; // files with monster movements
+    script_t* pacman_scripts; // moves of each pacman, same index as pacmans
+    script_t* ghost_scripts; // moves of each ghost, same index as ghosts
+    int n_commands;
+    command_t* commands; // moves of every script back to back, 'T' moves count their turns down in place
+    int row_words; // words of a layer row
+    int column_words; // words of a layer column
+    atomic_ullong* layers; // the layers after the static ones row by row, then the same layers column by column
+    atomic_int* occupants; // index of the pacman or ghost in each cell, the cell kind tells which
+    level_t* level; // walls, portals and passable masks shared with every session on the level
+    arena_t* arena; // the arrays above were carved from it, NULL when they were malloc'ed
     int tempo; // Duracao de cada jogada???
-    pthread_rwlock_t state_lock;
+    brlock_t state_lock; // read by every entity move, written only to end a round
     bool session_active;
 } board_t;
 
+/*Words of the layers a board keeps for itself, rows and columns*/
+static inline int board_layer_words(board_t* board) {
+    return (N_LAYERS - N_STATIC_LAYERS) * (board->height * board->row_words + board->width * board->column_words);
+}
+
+/*Word of a layer holding the bit of (x, y)*/
+static inline atomic_ullong* layer_word(board_t* board, int layer, int x, int y) {
+    if (layer < N_STATIC_LAYERS) {
+        return &board->level->layers[(layer * board->height + y) * board->row_words + x / LAYER_WORD_BITS];
+    }
+    return &board->layers[((layer - N_STATIC_LAYERS) * board->height + y) * board->row_words + x / LAYER_WORD_BITS];
+}
+
+/*Word of the column copy of a layer holding the bit of (x, y), so vertical scans also go a word at a time*/
+static inline atomic_ullong* layer_column_word(board_t* board, int layer, int x, int y) {
+    if (layer < N_STATIC_LAYERS) {
+        atomic_ullong* columns = &board->level->layers[N_STATIC_LAYERS * board->height * board->row_words];
+        return &columns[(layer * board->width + x) * board->column_words + y / LAYER_WORD_BITS];
+    }
+    atomic_ullong* columns = &board->layers[(N_LAYERS - N_STATIC_LAYERS) * board->height * board->row_words];
+    return &columns[((layer - N_STATIC_LAYERS) * board->width + x) * board->column_words + y / LAYER_WORD_BITS];
+}
+
+static inline bool layer_test(board_t* board, int layer, int x, int y) {
+    return (atomic_load_explicit(layer_word(board, layer, x, y), memory_order_relaxed) >> (x % LAYER_WORD_BITS)) & 1;
+}
+
+/*Only the entity holding the cell may set or clear its occupancy bit*/
+static inline void layer_set(board_t* board, int layer, int x, int y) {
+    atomic_fetch_or_explicit(layer_word(board, layer, x, y), 1ULL << (x % LAYER_WORD_BITS), memory_order_relaxed);
+    atomic_fetch_or_explicit(layer_column_word(board, layer, x, y), 1ULL << (y % LAYER_WORD_BITS), memory_order_relaxed);
+}
+
+static inline void layer_clear(board_t* board, int layer, int x, int y) {
+    atomic_fetch_and_explicit(layer_word(board, layer, x, y), ~(1ULL << (x % LAYER_WORD_BITS)), memory_order_relaxed);
+    atomic_fetch_and_explicit(layer_column_word(board, layer, x, y), ~(1ULL << (y % LAYER_WORD_BITS)), memory_order_relaxed);
+}
+
+/*Command a ghost with a script plays next*/
+static inline command_t* ghost_command(board_t* board, int ghost_index) {
+    ghost_t* ghost = &board->ghosts[ghost_index];
+    return &board->commands[board->ghost_scripts[ghost_index].first_move + ghost->current_move % ghost->n_moves];
+}
+
+/*Index of the pacman or ghost in a cell, only meaningful while the cell holds one*/
+static inline int cell_occupant(board_t* board, int index) {
+    return atomic_load_explicit(&board->occupants[index], memory_order_relaxed);
+}
+
+/*
+Walls, dots and portals are exact copies of the cells. The ghost and pacman
+layers are set by whoever claims a cell right after the claim and cleared
+right before it is released, so they only lag a move that is still going on.
+*/
+/*Builds the static layers and passable masks of the level of the board from its cells, -1 if out of memory*/
+int build_level(board_t* board);
+
+/*Builds the layers and the occupancy index of the board from its cells, its level must be set, -1 if out of memory*/
+int build_layers(board_t* board);
+
+/*Number of cells set in one of the layers of the board, a popcount per word*/
+int layer_count(board_t* board, int layer);
+
+/*Dots the pacman still has to eat, the level is cleared at zero*/
+static inline int dots_left(board_t* board) {
+    return layer_count(board, LAYER_DOTS);
+}
+
 /*Move pacman/monster in a certain direction on the board must check for boundaries, walls and other monsters
 Maybe do 1 function for pacman and 1 for monsters if required
 Maybe do 1 function for each direction
@@ -72,6 +239,19 @@ Maybe do 1 function for each direction
 int move_pacman(board_t* board, int pacman_index, command_t* command);
 int move_ghost(board_t* board, int ghost_index, command_t* command);
 
+/*
+First half of a ghost move for boards that move every ghost at once: plays the
+script of the ghost and returns the cell it wants to move into, -1 if it stays.
+Reads the board only, so every ghost can propose in parallel.
+*/
+int propose_ghost_move(board_t* board, int ghost_index, command_t* command);
+
+/*Second half, moves the ghost into the cell it won, only one ghost may commit to a cell*/
+int commit_ghost_move(board_t* board, int ghost_index, int target_index);
+
+/*Gives every entity of a freshly loaded level its own random stream, the same for the same session seed and level*/
+void seed_level(board_t* board, uint64_t session_seed, int level);
+
 /*Remove an object (Pacman)*/
 void kill_pacman(board_t* board, int pacman_index);
 
@@ -82,13 +262,26 @@ int load_pacman(board_t* board);
 int load_ghost(board_t* board);
 
 
+/*Parses filename in dirname into a level holding a single reference, NULL on error*/
+level_t* level_parse(char* filename, char* dirname);
+
+/*Drops a reference to a level, the last one frees it*/
+void level_release(level_t* level);
+
 /*
-Fils the board with the information coming from the file
+Fills the board with a copy of the board the level starts as, taking a reference to the level
+The arrays are carved from arena when it is not NULL, the caller rewinds it after unload_level
 */
-int load_level(board_t* board, char* filename, char* dirname, int accumulated_points);
+int load_level(board_t* board, level_t* level, int accumulated_points, arena_t* arena);
 // Unloads levels loaded by load_level
 void unload_level(board_t * board);
 
+/*Writes everything a loaded board needs to keep playing in another process, -1 on error*/
+int save_board(board_t* board, int fd);
+
+/*Rebuilds a board written by save_board as if load_level had loaded it from arena, -1 on error*/
+int restore_board(board_t* board, int fd, arena_t* arena);
+
 // DEBUG FILE
 
 void open_debug_file(char *filename);
@@ -101,4 +294,20 @@ void print_board(board_t* board);
 
 void sleep_ms(int milliseconds);
 
+/*Absolute CLOCK_MONOTONIC deadline of a periodic loop*/
+typedef struct {
+    struct timespec last; // deadline of the last tick
+} deadline_t;
+
+/*Starts the deadline grid at the current time*/
+void deadline_start(deadline_t* deadline);
+
+/*
+Sleeps until one period after the last deadline, never counting from when the
+caller got here, so time spent working does not stretch the tick. When that
+deadline has passed already it returns at once and skips to the latest one
+gone, returning how many deadlines were missed.
+*/
+int deadline_wait(deadline_t* deadline, int milliseconds);
+
 #endif
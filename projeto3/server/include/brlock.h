@@ -0,0 +1,42 @@
+#ifndef BRLOCK_H
+#define BRLOCK_H
+
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+
+#define CACHE_LINE_SIZE 64
+
+typedef struct {
+    _Alignas(CACHE_LINE_SIZE) atomic_bool active; // the reader owning this slot holds the lock
+} brlock_slot_t;
+
+/*
+Distributed reader-writer lock. Every reader has its own slot on a cache line
+of its own, so taking the lock for reading only writes that line and readers
+never bounce a shared counter between cores. Writers are expected to be rare:
+they raise a flag, on a line of its own in front of the reader slots, and
+wait for every slot to be released.
+*/
+typedef struct {
+    brlock_slot_t* writer; // active while a writer holds or is waiting for the lock, the slot before the readers'
+    pthread_mutex_t writer_lock; // one writer at a time
+    int n_readers;
+    brlock_slot_t* slots;
+} brlock_t;
+
+/*Creates a lock for readers numbered 0 to n_readers - 1*/
+int brlock_init(brlock_t* lock, int n_readers);
+
+void brlock_destroy(brlock_t* lock);
+
+/*Each reader may only use its own slot, one thread per slot at a time*/
+void brlock_read_lock(brlock_t* lock, int reader);
+
+void brlock_read_unlock(brlock_t* lock, int reader);
+
+void brlock_write_lock(brlock_t* lock);
+
+void brlock_write_unlock(brlock_t* lock);
+
+#endif
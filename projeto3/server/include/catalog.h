@@ -0,0 +1,53 @@
+#ifndef CATALOG_H
+#define CATALOG_H
+
+#include <time.h>
+#include "board.h"
+
+#define CATALOG_SETTLE_MS 200 // quiet time after a change in the level directory before it is read again
+#define CATALOG_CLOCK_MARGIN_MS 20 // file times lag the real time clock by up to a kernel tick
+
+/*
+Every level of the level directory, parsed once and read-only afterwards.
+Sessions play the levels in the order of their file names and start each
+one as a copy of the board it was parsed into, so connecting clients never
+touch the disk.
+
+Catalogs are versioned: when the directory changes a new version is built
+on the side, reusing every level whose files did not change since the
+previous one, and published in its place. A game keeps the version it
+started on until it ends, the last one to let go of an old version frees it.
+*/
+typedef struct {
+    atomic_int refs; // games playing it, plus one while it is the current version
+    unsigned long version;
+    struct timespec built; // files changed after this are read again by the next version
+    int n_levels;
+    level_t** levels; // sorted by file name, the catalog holds a reference to each
+} catalog_t;
+
+/*
+Loads every level of dirname as the first version, skipping the ones that fail, -1 if the directory can't be read
+A level compiled by levelc is mapped instead of parsed, unless its .lvl file is newer
+*/
+int catalog_open(char* dirname);
+
+/*Publishes a new version whenever the level directory changes, from a thread of its own, -1 if it can't be watched*/
+int catalog_watch();
+
+/*Current version, for a game about to start*/
+catalog_t* catalog_acquire();
+
+/*Gives back a version taken by catalog_acquire*/
+void catalog_release(catalog_t* catalog);
+
+/*Level played in position index, NULL past the last one*/
+level_t* catalog_level(catalog_t* catalog, int index);
+
+/*Position of the level played after the one called name, after where name would sort when this version lacks it*/
+int catalog_level_after(catalog_t* catalog, const char* name);
+
+/*Stops watching and drops the current version, games still playing one keep it alive*/
+void catalog_close();
+
+#endif
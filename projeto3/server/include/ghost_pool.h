@@ -0,0 +1,35 @@
+#ifndef GHOST_POOL_H
+#define GHOST_POOL_H
+
+#include "board.h"
+
+#define GHOST_POOL_MIN_GHOSTS 256 // boards with fewer ghosts keep moving them one by one
+#define GHOST_POOL_CHUNK 64 // ghosts handed to a thread at a time
+
+/*
+Thread pool that moves every ghost of a big board in two phases. First each
+ghost proposes the cell it wants from the board as it was at the start of the
+tick, then every contested cell goes to the lowest ghost index and the winners
+commit. Both phases are split in chunks over the pool, so the outcome does not
+depend on how many threads there are or on how they are scheduled.
+*/
+typedef struct ghost_pool ghost_pool_t;
+
+/*Proposals and bids of one board, kept by its session so it never waits for another board*/
+typedef struct ghost_round ghost_round_t;
+
+/*Starts n_threads - 1 helper threads, the caller of ghost_pool_update is always the last one*/
+ghost_pool_t* ghost_pool_create(int n_threads);
+
+void ghost_pool_destroy(ghost_pool_t* pool);
+
+void ghost_round_free(ghost_round_t* round);
+
+/*
+Moves every ghost due on this tick, on the pool or on the calling thread alone
+while the pool is busy with another board. *round is allocated on first use.
+Returns DEAD_PACMAN if one of them caught the pacman.
+*/
+int ghost_pool_update(ghost_pool_t* pool, ghost_round_t** round, board_t* board, unsigned long tick);
+
+#endif
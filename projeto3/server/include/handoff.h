@@ -0,0 +1,37 @@
+#ifndef HANDOFF_H
+#define HANDOFF_H
+
+#include <stddef.h>
+
+#define HANDOFF_VERSION 10 // bump whenever what a session is saved as changes, board_t included
+#define HANDOFF_REFUSED (-2) // a server of another version is listening
+#define HANDOFF_MAX_FDS 2 // request and notification pipes of a session
+#define HANDOFF_POKE_MS 10 // how often the accept loop is poked until it notices
+
+/*
+Zero downtime restarts: a server started with -u listens on a local socket
+for the next server. When one connects the old server stops reading the
+register FIFO and hands every live session over, client pipe fds included
+as SCM_RIGHTS, so the new server resumes them where they were.
+*/
+typedef struct handoff handoff_t;
+
+/*Listens on path for the next server, waking up the accept loop blocked on register_pipe_name when it connects*/
+handoff_t* handoff_listen(const char* path, const char* register_pipe_name);
+
+/*Socket of the server taking over, -1 while none connected, also -1 for NULL*/
+int handoff_socket(handoff_t* handoff);
+
+/*Stops listening, the socket of the server taking over stays open*/
+void handoff_close(handoff_t* handoff);
+
+/*Connects to the server listening on path, -1 if there is none, HANDOFF_REFUSED if it runs another version*/
+int handoff_connect(const char* path);
+
+/*Sends size bytes along with n_fds descriptors, -1 on error*/
+int handoff_send(int sock, const void* data, size_t size, const int* fds, int n_fds);
+
+/*Receives size bytes and the descriptors sent with them, -1 on error or EOF*/
+int handoff_recv(int sock, void* data, size_t size, int* fds, int* n_fds);
+
+#endif
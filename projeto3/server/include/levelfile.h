@@ -0,0 +1,55 @@
+#ifndef LEVELFILE_H
+#define LEVELFILE_H
+
+#include <stdint.h>
+#include "board.h"
+
+#define LEVEL_FILE_EXTENSION ".lvb"
+#define LEVEL_FILE_MAGIC 0x42564c50 // "PLVB" in a little endian file
+#define LEVEL_FILE_VERSION 1 // bump whenever the layout changes, structs stored included
+#define LEVEL_FILE_ALIGN 64 // every section starts on a cache line
+
+// sections of a level file, in the order they are written
+enum {
+    SECTION_STATIC_LAYERS, // level_t::layers
+    SECTION_PASSABLE, // level_t::passable
+    SECTION_CELLS, // the start board from here on
+    SECTION_LAYERS,
+    SECTION_OCCUPANTS,
+    SECTION_PACMANS,
+    SECTION_GHOSTS,
+    SECTION_PACMAN_SCRIPTS,
+    SECTION_GHOST_SCRIPTS,
+    SECTION_COMMANDS,
+    SECTION_SOURCES, // pacman file, empty when the client plays, then one ghost file per ghost, each NUL terminated
+    N_SECTIONS
+};
+
+/*
+Compiled level: the header is followed by the arrays of a parsed level
+exactly as they sit in memory, so mapping the file gives a level ready to
+be played, with nothing to parse. Files are only meant for servers built
+like the one that compiled them, layout refuses the others. The pacman and
+ghost files the scripts were compiled from are kept by name, relative to
+the level directory, so the server can tell when the file is out of date.
+*/
+typedef struct {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t layout; // sizes of the structs stored, see level_file_layout
+    int32_t width, height;
+    int32_t tempo;
+    int32_t n_pacmans, n_ghosts;
+    int32_t n_commands;
+    int32_t row_words, column_words;
+    uint32_t sources_size; // bytes of SECTION_SOURCES
+    uint64_t offsets[N_SECTIONS]; // from the start of the file
+} level_file_t;
+
+/*Writes a parsed level to path, through a temporary file renamed over it, -1 on error*/
+int level_write(level_t* level, char* path);
+
+/*Level mapped from a file written by level_write, holding a single reference, NULL if the file can't be used*/
+level_t* level_map(char* path, char* name);
+
+#endif
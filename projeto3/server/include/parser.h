@@ -1,10 +1,24 @@
 #ifndef PARSER_H
 #define PARSER_H
 
+#include <stddef.h>
 #include "board.h"
-#define MAX_COMMAND_LENGTH 256
 
-int read_line(int fd, char* buffer);
+/*A whole file read at once and handed out a line at a time*/
+typedef struct {
+    char* data; // the file plus a terminating '\0'
+    size_t size;
+    size_t next; // offset of the next line
+} line_reader_t;
+
+/*Reads the file at path with a single read, -1 on error*/
+int reader_open(line_reader_t* reader, const char* path);
+
+/*Next line in place, without its newline, valid until reader_close, NULL at the end of the file*/
+char* reader_next(line_reader_t* reader);
+
+void reader_close(line_reader_t* reader);
+
 int read_level(board_t* board, char* filename, char* dirname);
 int read_pacman(board_t* board, int points);
 int read_ghosts(board_t* board);
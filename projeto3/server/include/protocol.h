@@ -5,6 +5,7 @@
 
 #define MAX_PIPE_PATH_LENGTH 40
 #define QUEUE_SIZE 64
+#define CONNECT_RECORD_SIZE (1 + 2 * MAX_PIPE_PATH_LENGTH) // op code and both client pipe paths
 
 enum {
   OP_CODE_CONNECT = 1,
@@ -13,7 +14,7 @@ enum {
   OP_CODE_BOARD = 4,
 };
 
-ssize_t read_full(int fd, void *buf, size_t size) {
+static inline ssize_t read_full(int fd, void *buf, size_t size) {
     size_t total = 0;
     while (total < size) {
         ssize_t n = read(fd, (char*)buf + total, size - total);
@@ -23,7 +24,7 @@ ssize_t read_full(int fd, void *buf, size_t size) {
     return total;
 }
 
-ssize_t write_full(int fd, const void *buf, size_t size) {
+static inline ssize_t write_full(int fd, const void *buf, size_t size) {
     size_t total = 0;
     const char *ptr = buf;
 
@@ -0,0 +1,38 @@
+#ifndef REACTOR_H
+#define REACTOR_H
+
+#include "board.h"
+#include "catalog.h"
+#include "ghost_pool.h"
+
+#define REACTOR_MAX_EVENTS 64 // events handled per epoll_wait
+#define CONNECT_RETRY_MS 10 // how often to retry opening the notification pipe
+#define CONNECT_ATTEMPTS 500 // retries before the client is given up on
+#define DISCONNECT_TIMEOUT_MS 5000 // time given to the client to read its last frames
+
+/*
+Event driven session engine: every client pipe is registered with epoll and
+a fixed pool of workers runs all the sessions as non-blocking state machines
+on top of the tick engine. Each worker keeps the tick deadlines of its
+sessions on a timer wheel behind a single timerfd. Ticks themselves are
+tasks of a work-stealing scheduler, so idle workers take over the ticks of
+workers whose sessions have heavier levels.
+*/
+typedef struct reactor reactor_t;
+
+/*Starts n_workers workers that will run at most max_games sessions at once, each game on the catalog version current when it starts, big boards move their ghosts on ghost_pool*/
+reactor_t* reactor_create(int n_workers, int max_games, ghost_pool_t* ghost_pool);
+
+/*Hands a connecting client to the next worker in turn, or queues it while every slot is taken*/
+void reactor_add_client(reactor_t* reactor, char* client_request_pipe, char* client_notification_pipe);
+
+/*Stops the workers and drops every session still running*/
+void reactor_destroy(reactor_t* reactor);
+
+/*Stops the workers and sends every session to the server taking over on sock, then frees the reactor, -1 on error*/
+int reactor_hand_off(reactor_t* reactor, int sock);
+
+/*Resumes the sessions sent by reactor_hand_off of the previous server, returns how many*/
+int reactor_take_over(reactor_t* reactor, int sock);
+
+#endif
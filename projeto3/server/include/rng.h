@@ -0,0 +1,28 @@
+#ifndef RNG_H
+#define RNG_H
+
+#include <stdint.h>
+
+/*xoshiro256** generator, small enough to give one to every entity*/
+typedef struct {
+    uint64_t s[4];
+} rng_t;
+
+/*Expands a 64 bit seed into the full state*/
+void rng_seed(rng_t* rng, uint64_t seed);
+
+uint64_t rng_next(rng_t* rng);
+
+/*Random direction for 'R' moves, one of WASD*/
+char rng_direction(rng_t* rng);
+
+/*Gives the n-th session seed + n instead of a seed from the clock, so a logged seed can be replayed*/
+void rng_set_base_seed(uint64_t seed);
+
+/*Keeps the session seeds of worker processes apart, worker n counts its sessions from n << 32*/
+void rng_set_process(int index);
+
+/*Seed for a new session, distinct for every call*/
+uint64_t rng_session_seed();
+
+#endif
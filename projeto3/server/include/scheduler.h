@@ -0,0 +1,70 @@
+#ifndef SCHEDULER_H
+#define SCHEDULER_H
+
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+
+#define SCHEDULER_INITIAL_CAPACITY 64 // tasks per deque before it grows
+#define SCHEDULER_REPORT_MS 10000 // how often worker utilization is logged
+
+typedef struct {
+    void (*run)(void* arg);
+    void* arg;
+} task_t;
+
+/*
+One deque per worker: the owner takes the oldest task from the head, idle
+workers steal the newest one from the tail so they rarely meet the owner.
+*/
+typedef struct {
+    pthread_mutex_t lock;
+    task_t* tasks; // ring buffer
+    int capacity;
+    int head;
+    atomic_int size; // changed under lock, peeked without it by thieves
+    // utilization counters, readable from any thread
+    atomic_ulong tasks_run; // tasks run by this worker, stolen ones included
+    atomic_ulong tasks_stolen; // tasks this worker took from another deque
+    atomic_ullong busy_ns; // time spent running tasks
+    atomic_ullong idle_ns; // time spent waiting for work
+} scheduler_worker_t;
+
+typedef struct {
+    int n_workers;
+    scheduler_worker_t* workers;
+} scheduler_t;
+
+typedef struct {
+    unsigned long tasks_run;
+    unsigned long tasks_stolen;
+    unsigned long long busy_ns;
+    unsigned long long idle_ns;
+} scheduler_stats_t;
+
+scheduler_t* scheduler_create(int n_workers);
+
+void scheduler_destroy(scheduler_t* scheduler);
+
+/*Queues a task on the deque of the given worker, returns how many tasks that deque holds, -1 if it can't grow*/
+int scheduler_push(scheduler_t* scheduler, int worker, task_t task);
+
+/*Runs up to max_tasks tasks, from the worker's own deque first and then stolen from others*/
+int scheduler_run(scheduler_t* scheduler, int worker, int max_tasks);
+
+/*Takes the oldest task of the worker's own deque without running it, false if there is none*/
+bool scheduler_take(scheduler_t* scheduler, int worker, task_t* task);
+
+/*Adds time the worker spent with nothing to run*/
+void scheduler_add_idle(scheduler_t* scheduler, int worker, unsigned long long ns);
+
+/*Copies the utilization counters of one worker*/
+void scheduler_stats(scheduler_t* scheduler, int worker, scheduler_stats_t* stats);
+
+/*Writes the utilization of every worker to the debug file*/
+void scheduler_report(scheduler_t* scheduler);
+
+/*Monotonic clock in nanoseconds*/
+unsigned long long scheduler_now_ns();
+
+#endif
@@ -0,0 +1,31 @@
+#ifndef SHARD_H
+#define SHARD_H
+
+#include "board.h"
+#include "protocol.h"
+
+/*
+Multi-process mode: the master process keeps reading the register FIFO and
+hands every connect record to one of n pre-forked worker processes, the one
+running the fewest sessions. Each worker runs its own session pool, with its
+own allocator and debug file, so a worker that crashes only takes its own
+sessions down. It is forked again on the next connect.
+*/
+typedef struct shards shards_t;
+
+/*Body of a worker process, reads connect records from dispatch_fd until EOF, its result is the exit status*/
+typedef int (*shard_main_t)(int index, int dispatch_fd, void* arg);
+
+/*Forks n_workers processes running worker_main, NULL if none could be started*/
+shards_t* shards_create(int n_workers, shard_main_t worker_main, void* arg);
+
+/*Writes a connect record to the least loaded worker, returns its index or -1 if every worker is gone*/
+int shards_dispatch(shards_t* shards, const char* record);
+
+/*Closes the dispatch pipes and waits for the workers to finish their sessions*/
+void shards_destroy(shards_t* shards);
+
+/*Called by a worker every time one of its sessions ends, does nothing outside the workers*/
+void shard_session_done();
+
+#endif
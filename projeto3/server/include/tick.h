@@ -0,0 +1,72 @@
+#ifndef TICK_H
+#define TICK_H
+
+#include "board.h"
+#include "ghost_pool.h"
+
+#define CONTINUE_PLAY 0
+#define NEXT_LEVEL 1
+#define QUIT_GAME 2
+#define LOAD_BACKUP 3
+#define CREATE_BACKUP 4
+
+#define TICK_INPUT_SIZE 64 // bytes of client requests buffered per session
+#define TICK_MAX_BACKLOG (1 << 20) // unsent frame bytes before the client is dropped
+#define TICK_DEBUG_LINE 256 // bytes of a board row per debug call, wider rows take several
+
+/*
+Single threaded game engine: every tick advances the pacman, then every ghost
+by index order, then emits one frame to the client. Nothing in here blocks.
+Boards with a lot of ghosts move them on a ghost pool instead, when there is one.
+*/
+typedef struct {
+    board_t* board;
+    int client_request_fd; // opened with O_NONBLOCK, owned by the session
+    int client_notification_fd;
+    int* accumulated_points;
+    ghost_pool_t* ghost_pool; // NULL moves the ghosts one by one whatever their number
+    ghost_round_t* ghost_round; // NULL until the board first goes to the ghost pool
+    unsigned long tick; // ticks since the level started
+    char input[TICK_INPUT_SIZE]; // requests read but not played yet
+    int n_input;
+    char* output; // frames not written yet, only grows on non-blocking pipes
+    int output_size;
+    int output_capacity;
+    arena_t output_arena; // output is carved from it, outliving the levels the frames were sent for
+} tick_session_t;
+
+/*Binds the client pipes to a tick session, once per client*/
+void tick_init(tick_session_t* session, int client_request_fd, int client_notification_fd, int* accumulated_points,
+               ghost_pool_t* ghost_pool);
+
+/*Restarts the tick counter on a freshly loaded board*/
+void tick_start_level(tick_session_t* session, board_t* board);
+
+/*Writes the tick counter, the requests not played yet and the frames not sent yet, -1 on error*/
+int tick_save(tick_session_t* session, int fd);
+
+/*Reads what tick_save wrote into a session bound with tick_init, -1 on error*/
+int tick_restore(tick_session_t* session, int fd);
+
+/*Frees the buffers owned by the session*/
+void tick_destroy(tick_session_t* session);
+
+/*Runs one tick, returns CONTINUE_PLAY or the result that ends the level*/
+int tick_advance(tick_session_t* session);
+
+/*Reads every request available on the request pipe, -1 on error*/
+int tick_read_requests(tick_session_t* session);
+
+/*Queues one frame and writes as much as the pipe takes, -1 on error*/
+int tick_send_frame(tick_session_t* session, int victory, int game_over);
+
+/*Writes queued frames, returns 1 if some are still pending, 0 if none, -1 on error*/
+int tick_flush(tick_session_t* session);
+
+/*Builds the OP_CODE_BOARD message sent to the client*/
+void board_to_message(char *message, board_t* game_board, int victory, int game_over, int accumulated_points);
+
+/*Size in bytes of the message built by board_to_message*/
+int board_message_size(board_t* game_board);
+
+#endif
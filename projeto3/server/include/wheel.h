@@ -0,0 +1,56 @@
+#ifndef WHEEL_H
+#define WHEEL_H
+
+#define WHEEL_BITS 8
+#define WHEEL_SIZE (1 << WHEEL_BITS) // inner wheel, one slot per millisecond
+#define WHEEL_MASK (WHEEL_SIZE - 1)
+#define WHEEL_OUTER_BITS 6
+#define WHEEL_OUTER_SIZE (1 << WHEEL_OUTER_BITS) // outer wheel, one slot per turn of the inner one
+#define WHEEL_OUTER_MASK (WHEEL_OUTER_SIZE - 1)
+
+typedef struct wheel_timer wheel_timer_t;
+
+struct wheel_timer {
+    unsigned long long expires; // absolute deadline, in milliseconds of the wheel clock
+    int period; // milliseconds between deadlines, 0 for a one-shot timer
+    unsigned long missed; // deadlines skipped because the timer could only fire after the next one
+    void (*fire)(wheel_timer_t* timer);
+    void* arg;
+    wheel_timer_t* next;
+    wheel_timer_t** pprev; // NULL while not scheduled
+};
+
+/*
+Two level hierarchical timer wheel on CLOCK_MONOTONIC. Periodic timers are
+re-armed on their own grid of absolute deadlines so a late firing never
+stretches the ticks that follow it.
+*/
+typedef struct {
+    unsigned long long base_ns; // monotonic time of millisecond 0
+    unsigned long long current; // last millisecond processed
+    wheel_timer_t* inner[WHEEL_SIZE];
+    wheel_timer_t* outer[WHEEL_OUTER_SIZE];
+    wheel_timer_t* overflow; // more than a full turn of the outer wheel away
+    int n_timers;
+} timer_wheel_t;
+
+void wheel_init(timer_wheel_t* wheel);
+
+/*Milliseconds elapsed on the wheel clock*/
+unsigned long long wheel_now(timer_wheel_t* wheel);
+
+/*Monotonic time in nanoseconds of a millisecond of the wheel clock, for timerfd_settime*/
+unsigned long long wheel_to_ns(timer_wheel_t* wheel, unsigned long long ms);
+
+/*Arms a timer delay_ms from now, then every period_ms if that is not 0*/
+void wheel_schedule(timer_wheel_t* wheel, wheel_timer_t* timer, int delay_ms, int period_ms);
+
+void wheel_cancel(timer_wheel_t* wheel, wheel_timer_t* timer);
+
+/*Fires every timer due until now, returns how many fired*/
+int wheel_advance(timer_wheel_t* wheel, unsigned long long now);
+
+/*Millisecond at which the wheel needs to advance again, -1 when it holds no timers*/
+long long wheel_next_expiry(timer_wheel_t* wheel);
+
+#endif
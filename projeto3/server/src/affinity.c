@@ -0,0 +1,99 @@
+#define _GNU_SOURCE // cpu_set_t and pthread_setaffinity_np
+#include "affinity.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <sched.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <sys/syscall.h>
+#include <linux/mempolicy.h>
+
+static int cpus[AFFINITY_MAX_CPUS];
+static int n_cpus = 0;
+
+int affinity_set_cpus(const char* list) {
+    char* copy = strdup(list);
+    char* save = NULL;
+    n_cpus = 0;
+    if (copy == NULL) return -1;
+
+    for (char* range = strtok_r(copy, ",", &save); range != NULL; range = strtok_r(NULL, ",", &save)) {
+        char* end;
+        long first = strtol(range, &end, 10);
+        long last = first;
+        if (*end == '-') last = strtol(end + 1, &end, 10);
+
+        if (end == range || *end != '\0' || first < 0 || last < first || last >= CPU_SETSIZE) {
+            free(copy);
+            n_cpus = 0;
+            return -1;
+        }
+        for (long cpu = first; cpu <= last && n_cpus < AFFINITY_MAX_CPUS; cpu++) {
+            cpus[n_cpus++] = (int) cpu;
+        }
+    }
+
+    free(copy);
+    return n_cpus > 0 ? 0 : -1;
+}
+
+void affinity_restrict(int part, int n_parts) {
+    if (n_cpus == 0) return;
+    if (n_cpus < n_parts) {
+        cpus[0] = cpus[part % n_cpus];
+        n_cpus = 1;
+        return;
+    }
+
+    int kept = 0;
+    for (int i = part; i < n_cpus; i += n_parts) {
+        cpus[kept++] = cpus[i];
+    }
+    n_cpus = kept;
+}
+
+int affinity_cpu(int index) {
+    if (n_cpus == 0) return -1;
+    return cpus[index % n_cpus];
+}
+
+int affinity_pin(int cpu) {
+    if (cpu < 0) return 0;
+
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    CPU_SET(cpu, &set);
+    int error = pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+    if (error != 0) {
+        debug("Could not pin thread to core %d: %s\n", cpu, strerror(error));
+        return -1;
+    }
+    return 0;
+}
+
+// Helper private function, moves whole pages of memory the session owns to a node
+static void bind_range(void* address, size_t size, void* arg) {
+    int node = *(int*) arg;
+    uintptr_t page = (uintptr_t) sysconf(_SC_PAGESIZE);
+    // a page shared with memory of other sessions would move under them too
+    if ((uintptr_t) address % page != 0 || size % page != 0) return;
+
+    unsigned long nodemask = 1UL << node;
+    if (syscall(SYS_mbind, address, size, MPOL_PREFERRED, &nodemask, 8 * sizeof(nodemask), MPOL_MF_MOVE) < 0) {
+        debug("mbind to node %d failed: %s\n", node, strerror(errno));
+    }
+}
+
+void affinity_bind_board(board_t* board) {
+    // a malloc'ed board shares its pages with the rest of the heap
+    if (n_cpus == 0 || board->arena == NULL) return;
+
+    unsigned int cpu, node;
+    if (syscall(SYS_getcpu, &cpu, &node, NULL) < 0 || node >= 8 * sizeof(unsigned long)) return;
+
+    int target = (int) node;
+    arena_visit_blocks(board->arena, bind_range, &target);
+}
@@ -0,0 +1,113 @@
+#include "arena.h"
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#define ARENA_ALIGN (_Alignof(max_align_t))
+
+struct arena_block {
+    arena_block_t* next;
+    size_t size; // bytes of data
+    size_t offset; // bytes of data handed out
+    max_align_t data[];
+};
+
+void arena_init(arena_t* arena, size_t block_size) {
+    arena->blocks = NULL;
+    arena->spare = NULL;
+    arena->block_size = block_size;
+    arena->used = 0;
+    arena->peak = 0;
+}
+
+// Helper private function, a spare block with room for size bytes, a new one if none has
+static arena_block_t* take_block(arena_t* arena, size_t size) {
+    arena_block_t** link = &arena->spare;
+    while (*link != NULL && (*link)->size < size) link = &(*link)->next;
+
+    arena_block_t* block = *link;
+    if (block != NULL) {
+        *link = block->next;
+    }
+    else {
+        // whole pages, so a block can be moved to another NUMA node without dragging anything else
+        size_t page = (size_t) sysconf(_SC_PAGESIZE);
+        size_t block_size = size > arena->block_size ? size : arena->block_size;
+        size_t total = (sizeof(arena_block_t) + block_size + page - 1) & ~(page - 1);
+        block = aligned_alloc(page, total);
+        if (block == NULL) return NULL;
+        block->size = total - sizeof(arena_block_t);
+    }
+
+    block->offset = 0;
+    block->next = arena->blocks;
+    arena->blocks = block;
+    return block;
+}
+
+void* arena_alloc(arena_t* arena, size_t size) {
+    size = (size + ARENA_ALIGN - 1) & ~(ARENA_ALIGN - 1);
+
+    // what is left of the current block is lost when it has no room
+    arena_block_t* block = arena->blocks;
+    if (block == NULL || block->size - block->offset < size) {
+        block = take_block(arena, size);
+        if (block == NULL) return NULL;
+    }
+
+    void* memory = (char*) block->data + block->offset;
+    block->offset += size;
+    arena->used += size;
+    if (arena->used > arena->peak) arena->peak = arena->used;
+    return memory;
+}
+
+void* arena_calloc(arena_t* arena, size_t n, size_t size) {
+    void* memory = arena_alloc(arena, n * size);
+    if (memory != NULL) memset(memory, 0, n * size);
+    return memory;
+}
+
+char* arena_strdup(arena_t* arena, const char* string) {
+    size_t size = strlen(string) + 1;
+    char* copy = arena_alloc(arena, size);
+    if (copy != NULL) memcpy(copy, string, size);
+    return copy;
+}
+
+arena_mark_t arena_mark(arena_t* arena) {
+    arena_mark_t mark = {arena->blocks, arena->blocks ? arena->blocks->offset : 0, arena->used};
+    return mark;
+}
+
+void arena_rewind(arena_t* arena, arena_mark_t mark) {
+    while (arena->blocks != mark.block) {
+        arena_block_t* block = arena->blocks;
+        arena->blocks = block->next;
+        block->next = arena->spare;
+        arena->spare = block;
+    }
+    if (mark.block != NULL) mark.block->offset = mark.offset;
+    arena->used = mark.used;
+}
+
+void arena_visit_blocks(arena_t* arena, void (*visit)(void* start, size_t size, void* arg), void* arg) {
+    for (arena_block_t* block = arena->blocks; block != NULL; block = block->next) {
+        visit(block, sizeof(arena_block_t) + block->size, arg);
+    }
+}
+
+void arena_reset(arena_t* arena) {
+    arena_mark_t empty = {NULL, 0, 0};
+    arena_rewind(arena, empty);
+    arena->peak = 0;
+}
+
+void arena_destroy(arena_t* arena) {
+    arena_reset(arena);
+    while (arena->spare != NULL) {
+        arena_block_t* block = arena->spare;
+        arena->spare = block->next;
+        free(block);
+    }
+}
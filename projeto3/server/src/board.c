@@ -1,26 +1,43 @@
 #include "board.h"
+#include "protocol.h"
 #include "parser.h"
 #include <stdlib.h>
+#include <limits.h>
+#include <string.h>
 #include <stdio.h> //snprintf
 #include <fcntl.h>
 #include <time.h>
+#include <errno.h>
 #include <unistd.h>
 #include <stdarg.h>
 #include <pthread.h>
+#include <sys/mman.h>
 
 FILE * debugfile;
 
-// Helper private function to find and kill pacman at specific position
-static int find_and_kill_pacman(board_t* board, int new_x, int new_y) {
-    for (int p = 0; p < board->n_pacmans; p++) {
-        pacman_t* pac = &board->pacmans[p];
-        if (pac->pos_x == new_x && pac->pos_y == new_y && pac->alive) {
-            pac->alive = 0;
-            kill_pacman(board, p);
-            return DEAD_PACMAN;
-        }
+// Helper private function, the state of a cell with another kind and the same flags
+static inline unsigned char with_kind(unsigned char state, unsigned char kind) {
+    return (state & CELL_FLAGS) | kind;
+}
+
+// Helper private function, empties a cell if an entity of the given kind is still in it
+static bool release_cell(board_pos_t* pos, unsigned char kind) {
+    unsigned char state = atomic_load(&pos->state);
+    while ((state & CELL_KIND) == kind) {
+        if (atomic_compare_exchange_weak(&pos->state, &state, with_kind(state, CELL_EMPTY))) return true;
     }
-    return VALID_MOVE;
+    return false;
+}
+
+// Helper private function, the living pacman standing on (x, y), -1 if it is still on its way there
+static int pacman_at(board_t* board, int x, int y) {
+    int i = cell_occupant(board, y * board->width + x);
+    if (i < 0 || i >= board->n_pacmans) return -1;
+
+    // the index is written right after the claim, the pacman may not have gotten this far yet
+    pacman_t* pac = &board->pacmans[i];
+    if (pac->pos_x == x && pac->pos_y == y && __atomic_load_n(&pac->alive, __ATOMIC_ACQUIRE)) return i;
+    return -1;
 }
 
 // Helper private function for getting board position index
@@ -40,6 +57,32 @@ void sleep_ms(int milliseconds) {
     nanosleep(&ts, NULL);
 }
 
+void deadline_start(deadline_t* deadline) {
+    clock_gettime(CLOCK_MONOTONIC, &deadline->last);
+}
+
+int deadline_wait(deadline_t* deadline, int milliseconds) {
+    long long period = milliseconds * 1000000LL;
+    long long next = deadline->last.tv_sec * 1000000000LL + deadline->last.tv_nsec + period;
+
+    struct timespec now_ts;
+    clock_gettime(CLOCK_MONOTONIC, &now_ts);
+    long long now = now_ts.tv_sec * 1000000000LL + now_ts.tv_nsec;
+
+    int missed = 0;
+    if (next <= now && period > 0) {
+        missed = (now - next) / period;
+        next += missed * period;
+    }
+
+    deadline->last.tv_sec = next / 1000000000LL;
+    deadline->last.tv_nsec = next % 1000000000LL;
+    if (next > now) {
+        while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &deadline->last, NULL) == EINTR);
+    }
+    return missed;
+}
+
 int move_pacman(board_t* board, int pacman_index, command_t* command) {
     if (pacman_index < 0 || !board->pacmans[pacman_index].alive) {
         return DEAD_PACMAN; // Invalid or dead pacman
@@ -59,23 +102,27 @@ int move_pacman(board_t* board, int pacman_index, command_t* command) {
     char direction = command->command;
 
     if (direction == 'R') {
-        char directions[] = {'W', 'S', 'A', 'D'};
-        direction = directions[rand() % 4];
+        direction = rng_direction(&board->pacman_scripts[pacman_index].rng);
     }
 
     // Calculate new position based on direction
+    unsigned char pass;
     switch (direction) {
         case 'W': // Up
             new_y--;
+            pass = PASS_UP;
             break;
         case 'S': // Down
             new_y++;
+            pass = PASS_DOWN;
             break;
         case 'A': // Left
             new_x--;
+            pass = PASS_LEFT;
             break;
         case 'D': // Right
             new_x++;
+            pass = PASS_RIGHT;
             break;
         case 'T': // Wait
             if (command->turns_left == 1) {
@@ -91,223 +138,198 @@ int move_pacman(board_t* board, int pacman_index, command_t* command) {
     // Logic for the WASD movement
     pac->current_move+=1;
 
-    // Check boundaries
-    if (!is_valid_position(board, new_x, new_y)) {
+    // Check boundaries and walls
+    if (!(board->level->passable[get_board_index(board, pac->pos_x, pac->pos_y)] & pass)) {
         return INVALID_MOVE;
     }
 
-    int new_index = get_board_index(board, new_x, new_y);
-    int old_index = get_board_index(board, pac->pos_x, pac->pos_y);
+    board_pos_t* source = &board->board[get_board_index(board, pac->pos_x, pac->pos_y)];
+    board_pos_t* target = &board->board[get_board_index(board, new_x, new_y)];
 
-    // locks
-    if (old_index < new_index) {
-        pthread_mutex_lock(&board->board[old_index].lock);
-        pthread_mutex_lock(&board->board[new_index].lock);
-    }
-    else {
-        pthread_mutex_lock(&board->board[new_index].lock);
-        pthread_mutex_lock(&board->board[old_index].lock);
-    }
+    // claim the target, looking again whenever a ghost changes it first
+    unsigned char state = atomic_load(&target->state);
+    do {
+        unsigned char target_kind = state & CELL_KIND;
 
-    char target_content = board->board[new_index].content;
+        // Portals win over whatever stands on them
+        if (state & CELL_PORTAL) continue;
 
-    if (board->board[new_index].has_portal) {
-        board->board[old_index].content = ' ';
-        board->board[new_index].content = 'P';
-        return REACHED_PORTAL;
-    }
-
-    // Check for walls
-    if (target_content == 'W') {
-        goto move_pacman_invalid;
-    }
-
-    // Check for ghosts
-    if (target_content == 'M') {
-        kill_pacman(board, pacman_index);
-        goto move_pacman_dead;
-    }
+        // Check for ghosts
+        if (target_kind == CELL_GHOST) {
+            kill_pacman(board, pacman_index);
+            return DEAD_PACMAN;
+        }
+    } while (!atomic_compare_exchange_weak(&target->state, &state, with_kind(state & ~CELL_DOT, CELL_PACMAN)));
+    atomic_store_explicit(&board->occupants[get_board_index(board, new_x, new_y)], pacman_index, memory_order_relaxed);
+    layer_set(board, LAYER_PACMAN, new_x, new_y);
 
     // Collect points
-    if (board->board[new_index].has_dot) {
+    if (state & CELL_DOT) {
+        layer_clear(board, LAYER_DOTS, new_x, new_y);
         pac->points++;
-        board->board[new_index].has_dot = 0;
     }
 
-    board->board[old_index].content = ' ';
+    // a ghost may have caught the pacman before it left the source, or in the target before it got there
+    layer_clear(board, LAYER_PACMAN, pac->pos_x, pac->pos_y);
+    bool escaped = release_cell(source, CELL_PACMAN);
     pac->pos_x = new_x;
     pac->pos_y = new_y;
-    board->board[new_index].content = 'P';
-
-    if (old_index < new_index) {
-        pthread_mutex_unlock(&board->board[old_index].lock);
-        pthread_mutex_unlock(&board->board[new_index].lock);
-    }
-    else {
-        pthread_mutex_unlock(&board->board[new_index].lock);
-        pthread_mutex_unlock(&board->board[old_index].lock);
-    }
-    
-    return VALID_MOVE;
-
-    move_pacman_invalid:
-    if (old_index < new_index) {
-        pthread_mutex_unlock(&board->board[old_index].lock);
-        pthread_mutex_unlock(&board->board[new_index].lock);
-    }
-    else {
-        pthread_mutex_unlock(&board->board[new_index].lock);
-        pthread_mutex_unlock(&board->board[old_index].lock);
+    if (!escaped || cell_kind(target) != CELL_PACMAN || !__atomic_load_n(&pac->alive, __ATOMIC_ACQUIRE)) {
+        kill_pacman(board, pacman_index);
+        return DEAD_PACMAN;
     }
-    return INVALID_MOVE;
 
-    move_pacman_dead:
-    if (old_index < new_index) {
-        pthread_mutex_unlock(&board->board[old_index].lock);
-        pthread_mutex_unlock(&board->board[new_index].lock);
+    if (state & CELL_PORTAL) {
+        return REACHED_PORTAL;
     }
-    else {
-        pthread_mutex_unlock(&board->board[new_index].lock);
-        pthread_mutex_unlock(&board->board[old_index].lock);
+    if ((state & CELL_DOT) && dots_left(board) == 0) {
+        return LEVEL_CLEARED;
     }
-    return DEAD_PACMAN;
+    return VALID_MOVE;
 }
 
-int move_ghost_charged(board_t* board, int ghost_index, char direction) {
+// Helper private function, moves a ghost into a cell it has claimed and kills the pacman that was there
+static int finish_ghost_move(board_t* board, int ghost_index, int new_x, int new_y, unsigned char claimed) {
     ghost_t* ghost = &board->ghosts[ghost_index];
-    int x = ghost->pos_x;
-    int y = ghost->pos_y;
-    int new_x = x;
-    int new_y = y;
-    int result;
 
-    ghost->charged = 0; //uncharge
+    // Check for pacman before the ghost takes its place in the index, one still moving into the cell notices by itself
+    int pacman_index = (claimed & CELL_KIND) == CELL_PACMAN ? pacman_at(board, new_x, new_y) : -1;
 
-    switch (direction) {
-        case 'W':
-            if (y == 0) return INVALID_MOVE;
+    atomic_store_explicit(&board->occupants[get_board_index(board, new_x, new_y)], ghost_index, memory_order_relaxed);
+    layer_set(board, LAYER_GHOSTS, new_x, new_y);
+    layer_clear(board, LAYER_GHOSTS, ghost->pos_x, ghost->pos_y);
+    release_cell(&board->board[get_board_index(board, ghost->pos_x, ghost->pos_y)], CELL_GHOST);
+    ghost->pos_x = new_x;
+    ghost->pos_y = new_y;
 
-            for (int i = 0; i <= y; i++) {
-                pthread_mutex_lock(&board->board[i * board->width + x].lock);
-            }
+    if ((claimed & CELL_KIND) == CELL_PACMAN) {
+        if (pacman_index >= 0) kill_pacman(board, pacman_index);
+        return DEAD_PACMAN;
+    }
+    return VALID_MOVE;
+}
 
-            new_y = 0; // In case there is no colision
-            for (int i = y - 1; i >= 0; i--) {
-                char target_content = board->board[i * board->width + x].content;
-                if (target_content == 'W' || target_content == 'M') {
-                    new_y = i + 1; // stop before colision
-                    result = VALID_MOVE;
-                    break;
-                }
-                else if (target_content == 'P') {
-                    new_y = i;
-                    result = find_and_kill_pacman(board, new_x, new_y);
-                    break;
-                }
-            }
+// Helper private function, unit step of a direction, false if it is not one of WASD
+static bool direction_step(char direction, int* step_x, int* step_y) {
+    *step_x = 0;
+    *step_y = 0;
+    switch (direction) {
+        case 'W': // Up
+            *step_y = -1;
+            return true;
+        case 'S': // Down
+            *step_y = 1;
+            return true;
+        case 'A': // Left
+            *step_x = -1;
+            return true;
+        case 'D': // Right
+            *step_x = 1;
+            return true;
+        default:
+            return false;
+    }
+}
 
-            for (int i = 0; i <= y; i++) {
-                pthread_mutex_unlock(&board->board[i * board->width + x].lock);
-            }
-            break;
-        case 'S':
-            if (y == board->height - 1) return INVALID_MOVE;
+// Helper private function, passable bit of a unit step
+static inline unsigned char step_pass(int step_x, int step_y) {
+    if (step_y != 0) return step_y < 0 ? PASS_UP : PASS_DOWN;
+    return step_x < 0 ? PASS_LEFT : PASS_RIGHT;
+}
 
-            for (int i = y; i < board->height; i++) {
-                pthread_mutex_lock(&board->board[i * board->width + x].lock);
-            }
+// Helper private function, word w of a row (or a column) with every cell that ends a charge set
+static unsigned long long blockers_word(board_t* board, bool vertical, int line, int w) {
+    static const int blocking[] = {LAYER_WALLS, LAYER_GHOSTS, LAYER_PACMAN};
+    unsigned long long bits = 0;
+    for (int i = 0; i < 3; i++) {
+        atomic_ullong* word = vertical ? layer_column_word(board, blocking[i], line, w * LAYER_WORD_BITS)
+                                       : layer_word(board, blocking[i], w * LAYER_WORD_BITS, line);
+        bits |= atomic_load_explicit(word, memory_order_relaxed);
+    }
+    return bits;
+}
 
-            new_y = board->height - 1; // In case there is no colision
-            for (int i = y + 1; i < board->height; i++) {
-                char target_content = board->board[i * board->width + x].content;
-                if (target_content == 'W' || target_content == 'M') {
-                    new_y = i - 1; // stop before colision
-                    result = VALID_MOVE;
-                    break;
-                }
-                else if (target_content == 'P') {
-                    new_y = i;
-                    result = find_and_kill_pacman(board, new_x, new_y);
-                    break;
-                }
-            }
+// Helper private function, first blocked cell of a line past pos going step, -1 or length if it runs off the board
+static int first_blocker(board_t* board, bool vertical, int line, int length, int pos, int step) {
+    int start = pos + step;
+    if (start < 0 || start >= length) return start;
+
+    int w = start / LAYER_WORD_BITS;
+    int bit = start % LAYER_WORD_BITS;
+    if (step > 0) {
+        unsigned long long mask = ~0ULL << bit;
+        for (int n_words = (length + LAYER_WORD_BITS - 1) / LAYER_WORD_BITS; w < n_words; w++, mask = ~0ULL) {
+            unsigned long long bits = blockers_word(board, vertical, line, w) & mask;
+            if (bits) return w * LAYER_WORD_BITS + __builtin_ctzll(bits);
+        }
+        return length;
+    }
 
-            for (int i = y; i < board->height; i++) {
-                pthread_mutex_unlock(&board->board[i * board->width + x].lock);
-            }
-            break;
-        case 'A':
-            if (x == 0) return INVALID_MOVE;
+    unsigned long long mask = bit == LAYER_WORD_BITS - 1 ? ~0ULL : (1ULL << (bit + 1)) - 1;
+    for (; w >= 0; w--, mask = ~0ULL) {
+        unsigned long long bits = blockers_word(board, vertical, line, w) & mask;
+        if (bits) return w * LAYER_WORD_BITS + LAYER_WORD_BITS - 1 - __builtin_clzll(bits);
+    }
+    return -1;
+}
 
-            for (int j = 0; j <= x; j++) {
-                pthread_mutex_lock(&board->board[y * board->width + j].lock);
-            }
+// Helper private function, slides from (x, y) until the cell before a wall or a ghost, or onto the pacman
+static void charged_ray(board_t* board, int x, int y, int step_x, int step_y, int* new_x, int* new_y) {
+    bool vertical = step_y != 0;
+    int step = step_x + step_y;
+    int line = vertical ? x : y;
+    int length = vertical ? board->height : board->width;
+    int pos = vertical ? y : x;
 
-            new_x = 0; // In case there is no colision
-            for (int j = x - 1; j >= 0; j--) {
-                char target_content = board->board[y * board->width + j].content;
-                if (target_content == 'W' || target_content == 'M') {
-                    new_x = j + 1; // stop before colision
-                    result = VALID_MOVE;
-                    break;
-                }
-                else if (target_content == 'P') {
-                    new_x = j;
-                    result = find_and_kill_pacman(board, new_x, new_y);
-                    break;
-                }
-            }
+    // a word of the wall, ghost and pacman layers at a time instead of a cell at a time
+    int end = first_blocker(board, vertical, line, length, pos, step);
+    if (end < 0 || end >= length) {
+        end -= step;
+    }
+    else {
+        int index = vertical ? get_board_index(board, line, end) : get_board_index(board, end, line);
+        if (cell_kind(&board->board[index]) != CELL_PACMAN) end -= step;
+    }
 
-            for (int j = 0; j <= x; j++) {
-                pthread_mutex_unlock(&board->board[y * board->width + j].lock);
-            }
-            break;
-        case 'D':
-            if (x == board->width - 1) return INVALID_MOVE;
+    *new_x = vertical ? x : end;
+    *new_y = vertical ? end : y;
+}
 
-            for (int j = x; j < board->width; j++) {
-                pthread_mutex_lock(&board->board[y * board->width + j].lock);
-            }
+int move_ghost_charged(board_t* board, int ghost_index, char direction) {
+    ghost_t* ghost = &board->ghosts[ghost_index];
+    int x = ghost->pos_x;
+    int y = ghost->pos_y;
+    int step_x, step_y;
 
-            new_x = board->width - 1; // In case there is no colision
-            for (int j = x + 1; j < board->width; j++) {
-                char target_content = board->board[y * board->width + j].content;
-                if (target_content == 'W' || target_content == 'M') {
-                    new_x = j - 1; // stop before colision
-                    result = VALID_MOVE;
-                    break;
-                }
-                else if (target_content == 'P') {
-                    new_x = j;
-                    result = find_and_kill_pacman(board, new_x, new_y);
-                    break;
-                }
-            }
+    ghost->charged = 0; //uncharge
 
-            for (int j = x; j < board->width; j++) {
-                pthread_mutex_unlock(&board->board[y * board->width + j].lock);
-            }
-            break;
-        default:
-            debug("DEFAULT CHARGED MOVE - direction = %c\n", direction);
-            return INVALID_MOVE;
+    if (!direction_step(direction, &step_x, &step_y)) {
+        debug("DEFAULT CHARGED MOVE - direction = %c\n", direction);
+        return INVALID_MOVE;
     }
 
-    board->board[y * board->width + x].content = ' '; // Or restore the dot if ghost was on one
+    if (!is_valid_position(board, x + step_x, y + step_y)) return INVALID_MOVE;
 
-    // Update ghost position
-    ghost->pos_x = new_x;
-    ghost->pos_y = new_y;
+    while (true) {
+        int new_x, new_y;
+        charged_ray(board, x, y, step_x, step_y, &new_x, &new_y);
+        if (new_x == x && new_y == y) return VALID_MOVE;
 
-    // Update board - set new position
-    board->board[new_y * board->width + new_x].content = 'M';
-    return result;
+        // the ray is only a snapshot, slide again if the end of it changed before the claim
+        board_pos_t* target = &board->board[get_board_index(board, new_x, new_y)];
+        unsigned char state = atomic_load(&target->state);
+        unsigned char kind = state & CELL_KIND;
+        if (kind == CELL_WALL || kind == CELL_GHOST) continue;
+        if (atomic_compare_exchange_strong(&target->state, &state, with_kind(state, CELL_GHOST))) {
+            return finish_ghost_move(board, ghost_index, new_x, new_y, state);
+        }
+    }
 }
 
-int move_ghost(board_t* board, int ghost_index, command_t* command) {
+// Helper private function, plays the script of a ghost for one turn, *direction is 0 when it does not move
+static int ghost_direction(board_t* board, int ghost_index, command_t* command, char* direction) {
     ghost_t* ghost = &board->ghosts[ghost_index];
-    int new_x = ghost->pos_x;
-    int new_y = ghost->pos_y;
+    *direction = '\0';
 
     // check passo
     if (ghost->waiting > 0) {
@@ -316,27 +338,21 @@ int move_ghost(board_t* board, int ghost_index, command_t* command) {
     }
     ghost->waiting = ghost->passo;
 
-    char direction = command->command;
+    char next = command->command;
 
-    if (direction == 'R') {
-        char directions[] = {'W', 'S', 'A', 'D'};
-        direction = directions[rand() % 4];
+    if (next == 'R') {
+        next = rng_direction(&board->ghost_scripts[ghost_index].rng);
     }
 
-    // Calculate new position based on direction
-    switch (direction) {
-        case 'W': // Up
-            new_y--;
-            break;
-        case 'S': // Down
-            new_y++;
-            break;
-        case 'A': // Left
-            new_x--;
-            break;
-        case 'D': // Right
-            new_x++;
-            break;
+    switch (next) {
+        case 'W':
+        case 'S':
+        case 'A':
+        case 'D':
+            // Logic for the WASD movement
+            ghost->current_move++;
+            *direction = next;
+            return VALID_MOVE;
         case 'C': // Charge
             ghost->current_move += 1;
             ghost->charged = 1;
@@ -351,86 +367,189 @@ int move_ghost(board_t* board, int ghost_index, command_t* command) {
         default:
             return INVALID_MOVE; // Invalid direction
     }
+}
+
+int move_ghost(board_t* board, int ghost_index, command_t* command) {
+    ghost_t* ghost = &board->ghosts[ghost_index];
+    char direction;
+    int step_x, step_y;
+
+    int result = ghost_direction(board, ghost_index, command, &direction);
+    if (direction == '\0') return result;
 
-    // Logic for the WASD movement
-    ghost->current_move++;
     if (ghost->charged)
         return move_ghost_charged(board, ghost_index, direction);
 
-    // Check boundaries
-    if (!is_valid_position(board, new_x, new_y)) {
+    // Calculate new position based on direction
+    direction_step(direction, &step_x, &step_y);
+    int new_x = ghost->pos_x + step_x;
+    int new_y = ghost->pos_y + step_y;
+
+    // Check boundaries and walls
+    if (!(board->level->passable[get_board_index(board, ghost->pos_x, ghost->pos_y)] & step_pass(step_x, step_y))) {
         return INVALID_MOVE;
     }
 
-    // Check board position
-    int new_index = new_y * board->width + new_x;
-    int old_index = ghost->pos_y * board->width + ghost->pos_x;
+    // claim the target, looking again whenever someone changes it first
+    board_pos_t* target = &board->board[get_board_index(board, new_x, new_y)];
+    unsigned char state = atomic_load(&target->state);
+    do {
+        // Check for ghosts
+        if ((state & CELL_KIND) == CELL_GHOST) {
+            return INVALID_MOVE;
+        }
+    } while (!atomic_compare_exchange_weak(&target->state, &state, with_kind(state, CELL_GHOST)));
+
+    return finish_ghost_move(board, ghost_index, new_x, new_y, state);
+}
+
+int propose_ghost_move(board_t* board, int ghost_index, command_t* command) {
+    ghost_t* ghost = &board->ghosts[ghost_index];
+    char direction;
+    int step_x, step_y;
+    int new_x, new_y;
+
+    ghost_direction(board, ghost_index, command, &direction);
+    if (direction == '\0') return -1;
+
+    // a charge into a wall goes nowhere either
+    direction_step(direction, &step_x, &step_y);
+    if (!(board->level->passable[get_board_index(board, ghost->pos_x, ghost->pos_y)] & step_pass(step_x, step_y))) {
+        ghost->charged = 0;
+        return -1;
+    }
 
-    // locks
-    if (old_index < new_index) {
-        pthread_mutex_lock(&board->board[old_index].lock);
-        pthread_mutex_lock(&board->board[new_index].lock);
+    if (ghost->charged) {
+        ghost->charged = 0; //uncharge
+        charged_ray(board, ghost->pos_x, ghost->pos_y, step_x, step_y, &new_x, &new_y);
+        if (new_x == ghost->pos_x && new_y == ghost->pos_y) return -1;
     }
     else {
-        pthread_mutex_lock(&board->board[new_index].lock);
-        pthread_mutex_lock(&board->board[old_index].lock);
+        new_x = ghost->pos_x + step_x;
+        new_y = ghost->pos_y + step_y;
+        if (cell_kind(&board->board[get_board_index(board, new_x, new_y)]) == CELL_GHOST) return -1;
     }
 
-    char target_content = board->board[new_index].content;
+    return get_board_index(board, new_x, new_y);
+}
+
+int commit_ghost_move(board_t* board, int ghost_index, int target_index) {
+    // the cell is this ghost's alone for the commit, no need to compare
+    unsigned char state = atomic_load(&board->board[target_index].state);
+    atomic_store(&board->board[target_index].state, with_kind(state, CELL_GHOST));
 
-    // Check for walls
-    if (target_content == 'W') {
-        goto move_ghost_invalid;
-    }
+    return finish_ghost_move(board, ghost_index, target_index % board->width, target_index / board->width, state);
+}
+
+// Helper private function, an empty level with a single reference, for a board to be read into
+static level_t* create_level(board_t* board) {
+    level_t* level = calloc(1, sizeof(level_t));
+    if (level == NULL) return NULL;
+    atomic_init(&level->refs, 1);
+    board->level = level;
+    return level;
+}
 
-    // Check for ghosts
-    if (target_content == 'M') {
-        goto move_ghost_invalid;
+int build_level(board_t* board) {
+    board->row_words = (board->width + LAYER_WORD_BITS - 1) / LAYER_WORD_BITS;
+    board->column_words = (board->height + LAYER_WORD_BITS - 1) / LAYER_WORD_BITS;
+
+    level_t* level = board->level;
+    level->layers = calloc(N_STATIC_LAYERS * (board->height * board->row_words + board->width * board->column_words),
+                           sizeof(atomic_ullong));
+    level->passable = malloc(board->width * board->height);
+    if (level->layers == NULL || level->passable == NULL) return -1;
+
+    for (int y = 0; y < board->height; y++) {
+        for (int x = 0; x < board->width; x++) {
+            board_pos_t* pos = &board->board[get_board_index(board, x, y)];
+            if (cell_kind(pos) == CELL_WALL) layer_set(board, LAYER_WALLS, x, y);
+            if (cell_has_portal(pos)) layer_set(board, LAYER_PORTALS, x, y);
+        }
     }
 
-    int result = VALID_MOVE;
-    // Check for pacman
-    if (target_content == 'P') {
-        for (int i = 0; i < board->n_pacmans; i++) {
-            pacman_t* pac = &board->pacmans[i];
-            if (pac->pos_x == new_x && pac->pos_y == new_y && pac->alive) {
-                pac->alive = 0; // Pacman dies
-                kill_pacman(board, i);
-                result = DEAD_PACMAN;
-                break;
-            }
+    for (int y = 0; y < board->height; y++) {
+        for (int x = 0; x < board->width; x++) {
+            unsigned char pass = 0;
+            if (y > 0 && !layer_test(board, LAYER_WALLS, x, y - 1)) pass |= PASS_UP;
+            if (y < board->height - 1 && !layer_test(board, LAYER_WALLS, x, y + 1)) pass |= PASS_DOWN;
+            if (x > 0 && !layer_test(board, LAYER_WALLS, x - 1, y)) pass |= PASS_LEFT;
+            if (x < board->width - 1 && !layer_test(board, LAYER_WALLS, x + 1, y)) pass |= PASS_RIGHT;
+            level->passable[get_board_index(board, x, y)] = pass;
         }
     }
+    return 0;
+}
 
-    // Update board - clear old position (restore what was there)
-    board->board[old_index].content = ' '; // Or restore the dot if ghost was on one
-    // Update ghost position
-    ghost->pos_x = new_x;
-    ghost->pos_y = new_y;
-    // Update board - set new position
-    board->board[new_index].content = 'M';
+// Helper private function, memory for the arrays of a board, from its arena when it has one
+static void* board_alloc(board_t* board, size_t size) {
+    return board->arena != NULL ? arena_alloc(board->arena, size) : malloc(size);
+}
 
-    if (old_index < new_index) {
-        pthread_mutex_unlock(&board->board[old_index].lock);
-        pthread_mutex_unlock(&board->board[new_index].lock);
+// Helper private function, frees what a board points to but its level
+static void free_board(board_t* board) {
+    if (board->arena != NULL) return; // given back when the owner rewinds it
+
+    free(board->board);
+    free(board->pacmans);
+    free(board->ghosts);
+    free(board->pacman_scripts);
+    free(board->ghost_scripts);
+    free(board->commands);
+    free(board->layers);
+    free(board->occupants);
+}
+
+int build_layers(board_t* board) {
+    board->layers = board_alloc(board, board_layer_words(board) * sizeof(atomic_ullong));
+    board->occupants = board_alloc(board, board->width * board->height * sizeof(atomic_int));
+    if (board->layers == NULL || board->occupants == NULL) return -1;
+
+    memset(board->layers, 0, board_layer_words(board) * sizeof(atomic_ullong));
+    for (int i = 0; i < board->width * board->height; i++) {
+        atomic_init(&board->occupants[i], -1);
     }
-    else {
-        pthread_mutex_unlock(&board->board[new_index].lock);
-        pthread_mutex_unlock(&board->board[old_index].lock);
+
+    for (int y = 0; y < board->height; y++) {
+        for (int x = 0; x < board->width; x++) {
+            board_pos_t* pos = &board->board[get_board_index(board, x, y)];
+            if (cell_kind(pos) == CELL_GHOST) layer_set(board, LAYER_GHOSTS, x, y);
+            if (cell_kind(pos) == CELL_PACMAN) layer_set(board, LAYER_PACMAN, x, y);
+            if (cell_has_dot(pos)) layer_set(board, LAYER_DOTS, x, y);
+        }
     }
-    
-    return result;
 
-    move_ghost_invalid:
-    if (old_index < new_index) {
-        pthread_mutex_unlock(&board->board[old_index].lock);
-        pthread_mutex_unlock(&board->board[new_index].lock);
+    for (int i = 0; i < board->n_pacmans; i++) {
+        pacman_t* pac = &board->pacmans[i];
+        if (pac->alive) atomic_store(&board->occupants[get_board_index(board, pac->pos_x, pac->pos_y)], i);
     }
-    else {
-        pthread_mutex_unlock(&board->board[new_index].lock);
-        pthread_mutex_unlock(&board->board[old_index].lock);
+    for (int i = 0; i < board->n_ghosts; i++) {
+        ghost_t* ghost = &board->ghosts[i];
+        atomic_store(&board->occupants[get_board_index(board, ghost->pos_x, ghost->pos_y)], i);
+    }
+    return 0;
+}
+
+int layer_count(board_t* board, int layer) {
+    int n_words = board->height * board->row_words;
+    atomic_ullong* words = &board->layers[(layer - N_STATIC_LAYERS) * n_words];
+    int count = 0;
+    for (int i = 0; i < n_words; i++) {
+        count += __builtin_popcountll(atomic_load_explicit(&words[i], memory_order_relaxed));
+    }
+    return count;
+}
+
+void seed_level(board_t* board, uint64_t session_seed, int level) {
+    rng_t level_rng;
+    rng_seed(&level_rng, session_seed + level);
+
+    for (int i = 0; i < board->n_pacmans; i++) {
+        rng_seed(&board->pacman_scripts[i].rng, rng_next(&level_rng));
+    }
+    for (int i = 0; i < board->n_ghosts; i++) {
+        rng_seed(&board->ghost_scripts[i].rng, rng_next(&level_rng));
     }
-    return INVALID_MOVE;
 }
 
 void kill_pacman(board_t* board, int pacman_index) {
@@ -438,16 +557,17 @@ void kill_pacman(board_t* board, int pacman_index) {
     pacman_t* pac = &board->pacmans[pacman_index];
     int index = pac->pos_y * board->width + pac->pos_x;
 
-    // Remove pacman from the board
-    board->board[index].content = ' ';
+    // Remove pacman from the board, unless a ghost has taken its cell already
+    layer_clear(board, LAYER_PACMAN, pac->pos_x, pac->pos_y);
+    release_cell(&board->board[index], CELL_PACMAN);
 
     // Mark pacman as dead
-    pac->alive = 0;
+    __atomic_store_n(&pac->alive, 0, __ATOMIC_RELEASE);
 }
 
 // Static Loading
 int load_pacman(board_t* board) {
-    board->board[1 * board->width + 1].content = 'P'; // Pacman
+    cell_place(&board->board[1 * board->width + 1], CELL_PACMAN); // Pacman
     board->pacmans[0].pos_x = 1;
     board->pacmans[0].pos_y = 1;
     board->pacmans[0].alive = 1;
@@ -457,34 +577,114 @@ int load_pacman(board_t* board) {
 
 // Static Loading
 int load_ghost(board_t* board) {
-    board->board[4 * board->width + 8].content = 'M'; // Monster
+    cell_place(&board->board[4 * board->width + 8], CELL_GHOST); // Monster
     board->ghosts[0].pos_x = 8;
     board->ghosts[0].pos_y = 4;
-    board->board[0 * board->width + 5].content = 'M'; // Monster
+    cell_place(&board->board[0 * board->width + 5], CELL_GHOST); // Monster
     board->ghosts[1].pos_x = 5;
     board->ghosts[1].pos_y = 0;
     return 0;
 }
 
-int load_level(board_t *board, char *filename, char* dirname, int points) {
+level_t* level_parse(char* filename, char* dirname) {
+    board_t* start = calloc(1, sizeof(board_t));
+    if (start == NULL) return NULL;
 
-    if (read_level(board, filename, dirname) < 0) {
+    // the level is there before the parsing, which fills the file names in
+    level_t* level = create_level(start);
+    if (level == NULL || read_level(start, filename, dirname) < 0) {
         printf("Failed to load level\n");
-        return -1;
+        if (level != NULL) level_release(level);
+        free_board(start);
+        free(start);
+        return NULL;
     }
 
-    if (read_pacman(board, points) < 0) {
+    if (read_pacman(start, 0) < 0) {
         printf("Failed to load the pacman\n");
     }
 
-    if (read_ghosts(board) < 0) {
+    if (read_ghosts(start) < 0) {
         printf("Failed to read ghosts\n");
     }
 
-    pthread_rwlock_init(&board->state_lock, NULL);
+    if (build_level(start) < 0 || build_layers(start) < 0) {
+        printf("Failed to build the board layers\n");
+        level_release(level);
+        free_board(start);
+        free(start);
+        return NULL;
+    }
+    level->start = start;
+    level->path = malloc(strlen(dirname) + strlen(filename) + 2);
+    if (level->path != NULL) sprintf(level->path, "%s/%s", dirname, filename);
+    return level;
+}
 
-    for (int i = 0; i < board->height * board->width; i++) {
-        pthread_mutex_init(&board->board[i].lock, NULL);
+void level_release(level_t* level) {
+    if (atomic_fetch_sub(&level->refs, 1) > 1) return;
+
+    if (level->map != NULL) {
+        // only the start board itself is not part of the file
+        free(level->start);
+        munmap(level->map, level->map_size);
+    } else {
+        if (level->start != NULL) {
+            free_board(level->start);
+            free(level->start);
+        }
+        free(level->layers);
+        free(level->passable);
+    }
+    for (int i = 0; level->ghosts_files != NULL && level->ghosts_files[i] != NULL; i++) {
+        free(level->ghosts_files[i]);
+    }
+    free(level->ghosts_files);
+    free(level->pacman_file);
+    free(level->name);
+    free(level->path);
+    free(level);
+}
+
+int load_level(board_t *board, level_t* level, int points, arena_t* arena) {
+    atomic_fetch_add(&level->refs, 1);
+
+    // everything that moves is copied from the start, bitsets included, the rest stays in the level
+    board_t* start = level->start;
+    *board = *start;
+    board->arena = arena;
+    int n_cells = board->width * board->height;
+    board->board = board_alloc(board, n_cells * sizeof(board_pos_t));
+    board->pacmans = board_alloc(board, board->n_pacmans * sizeof(pacman_t));
+    board->ghosts = board_alloc(board, board->n_ghosts * sizeof(ghost_t));
+    board->pacman_scripts = board_alloc(board, board->n_pacmans * sizeof(script_t));
+    board->ghost_scripts = board_alloc(board, board->n_ghosts * sizeof(script_t));
+    board->commands = board_alloc(board, board->n_commands * sizeof(command_t));
+    board->layers = board_alloc(board, board_layer_words(board) * sizeof(atomic_ullong));
+    board->occupants = board_alloc(board, n_cells * sizeof(atomic_int));
+    if (board->board == NULL || board->pacmans == NULL || board->ghosts == NULL || board->pacman_scripts == NULL ||
+        board->ghost_scripts == NULL || (board->commands == NULL && board->n_commands > 0) ||
+        board->layers == NULL || board->occupants == NULL) {
+        printf("Failed to copy the level\n");
+        free_board(board);
+        level_release(level);
+        return -1;
+    }
+    memcpy(board->board, start->board, n_cells * sizeof(board_pos_t));
+    memcpy(board->pacmans, start->pacmans, board->n_pacmans * sizeof(pacman_t));
+    memcpy(board->ghosts, start->ghosts, board->n_ghosts * sizeof(ghost_t));
+    memcpy(board->pacman_scripts, start->pacman_scripts, board->n_pacmans * sizeof(script_t));
+    memcpy(board->ghost_scripts, start->ghost_scripts, board->n_ghosts * sizeof(script_t));
+    if (board->n_commands > 0) memcpy(board->commands, start->commands, board->n_commands * sizeof(command_t));
+    memcpy(board->layers, start->layers, board_layer_words(board) * sizeof(atomic_ullong));
+    memcpy(board->occupants, start->occupants, n_cells * sizeof(atomic_int));
+    board->pacmans[0].points = points;
+
+    if (brlock_init(&board->state_lock, STATE_LOCK_READERS(board->n_ghosts)) < 0) {
+        printf("Failed to create the state lock\n");
+        free_board(board);
+        level_release(level);
+        return -1;
     }
 
     //print_board(board);
@@ -492,13 +692,107 @@ int load_level(board_t *board, char *filename, char* dirname, int points) {
 }
 
 void unload_level(board_t * board) {
-    pthread_rwlock_destroy(&board->state_lock);
-    for (int i = 0; i < board->height * board->width; i++) {
-        pthread_mutex_destroy(&board->board[i].lock);
+    brlock_destroy(&board->state_lock);
+    free_board(board);
+    level_release(board->level);
+}
+
+int save_board(board_t* board, int fd) {
+    // the pointers, the lock and the level are rebuilt on the other side, walls and portals are in the cells too
+    if (write_full(fd, board, sizeof(board_t)) < 0) return -1;
+
+    // nothing moves while a board is saved, so the cells go as they are
+    if (write_full(fd, board->board, board->width * board->height * sizeof(board_pos_t)) < 0) return -1;
+    if (write_full(fd, board->pacmans, board->n_pacmans * sizeof(pacman_t)) < 0) return -1;
+    if (write_full(fd, board->ghosts, board->n_ghosts * sizeof(ghost_t)) < 0) return -1;
+    if (write_full(fd, board->pacman_scripts, board->n_pacmans * sizeof(script_t)) < 0) return -1;
+    if (write_full(fd, board->ghost_scripts, board->n_ghosts * sizeof(script_t)) < 0) return -1;
+    if (write_full(fd, board->commands, board->n_commands * sizeof(command_t)) < 0) return -1;
+
+    // the name is all the other side needs of the level, to show it
+    int name_length = strlen(board->level->name);
+    if (write_full(fd, &name_length, sizeof(name_length)) < 0) return -1;
+    if (write_full(fd, board->level->name, name_length) < 0) return -1;
+    return 0;
+}
+
+// Helper private function, whether the dimensions and counts of a board read from another server can be allocated and indexed
+static bool restored_counts_valid(board_t* board) {
+    if (board->width <= 0 || board->height <= 0 || board->width > INT_MAX / LAYER_WORD_BITS / board->height) return false;
+    int n_cells = board->width * board->height;
+    return board->n_pacmans >= 0 && board->n_pacmans <= n_cells && board->n_ghosts >= 0 && board->n_ghosts <= n_cells &&
+           board->n_commands >= 0;
+}
+
+// Helper private function, whether the cells and entities of a board read from another server are in range, as a level file must be
+static bool restored_contents_valid(board_t* board) {
+    for (int i = 0; i < board->width * board->height; i++) {
+        if (atomic_load(&board->board[i].state) > (CELL_KIND | CELL_FLAGS)) return false;
     }
-    free(board->board);
-    free(board->pacmans);
-    free(board->ghosts);
+    for (int i = 0; i < board->n_pacmans; i++) {
+        pacman_t* pac = &board->pacmans[i];
+        if (pac->pos_x < 0 || pac->pos_x >= board->width || pac->pos_y < 0 || pac->pos_y >= board->height) return false;
+        if (pac->passo < 0 || pac->n_moves < 0 || pac->current_move < 0 || board->pacman_scripts[i].first_move < 0 ||
+            board->pacman_scripts[i].first_move > board->n_commands - pac->n_moves) return false;
+    }
+    for (int i = 0; i < board->n_ghosts; i++) {
+        ghost_t* ghost = &board->ghosts[i];
+        if (ghost->pos_x < 0 || ghost->pos_x >= board->width || ghost->pos_y < 0 || ghost->pos_y >= board->height) return false;
+        if (ghost->passo < 0 || ghost->n_moves < 0 || ghost->current_move < 0 || board->ghost_scripts[i].first_move < 0 ||
+            board->ghost_scripts[i].first_move > board->n_commands - ghost->n_moves) return false;
+    }
+    return true;
+}
+
+int restore_board(board_t* board, int fd, arena_t* arena) {
+    if (read_full(fd, board, sizeof(board_t)) < 0) return -1;
+
+    // the pointers read are the ones of the other server
+    board->arena = arena;
+    board->board = NULL;
+    board->pacmans = NULL;
+    board->ghosts = NULL;
+    board->pacman_scripts = NULL;
+    board->ghost_scripts = NULL;
+    board->commands = NULL;
+    board->layers = NULL;
+    board->occupants = NULL;
+    board->level = NULL;
+    if (!restored_counts_valid(board)) goto fail;
+
+    // every array is filled by a read below
+    int n_cells = board->width * board->height;
+    board->board = board_alloc(board, n_cells * sizeof(board_pos_t));
+    board->pacmans = board_alloc(board, board->n_pacmans * sizeof(pacman_t));
+    board->ghosts = board_alloc(board, board->n_ghosts * sizeof(ghost_t));
+    board->pacman_scripts = board_alloc(board, board->n_pacmans * sizeof(script_t));
+    board->ghost_scripts = board_alloc(board, board->n_ghosts * sizeof(script_t));
+    board->commands = board_alloc(board, board->n_commands * sizeof(command_t));
+    if (board->board == NULL || board->pacmans == NULL || board->ghosts == NULL || board->pacman_scripts == NULL ||
+        board->ghost_scripts == NULL || (board->commands == NULL && board->n_commands > 0)) goto fail;
+
+    if (read_full(fd, board->board, n_cells * sizeof(board_pos_t)) < 0) goto fail;
+    if (read_full(fd, board->pacmans, board->n_pacmans * sizeof(pacman_t)) < 0) goto fail;
+    if (read_full(fd, board->ghosts, board->n_ghosts * sizeof(ghost_t)) < 0) goto fail;
+    if (read_full(fd, board->pacman_scripts, board->n_pacmans * sizeof(script_t)) < 0) goto fail;
+    if (read_full(fd, board->ghost_scripts, board->n_ghosts * sizeof(script_t)) < 0) goto fail;
+    if (read_full(fd, board->commands, board->n_commands * sizeof(command_t)) < 0) goto fail;
+    if (!restored_contents_valid(board)) goto fail;
+
+    // a level of its own, the sessions started here will share theirs again from the next level on
+    int name_length;
+    if (create_level(board) == NULL || read_full(fd, &name_length, sizeof(name_length)) < 0) goto fail;
+    if (name_length < 0 || name_length > MAX_FILENAME || (board->level->name = malloc(name_length + 1)) == NULL) goto fail;
+    if (read_full(fd, board->level->name, name_length) < 0) goto fail;
+    board->level->name[name_length] = '\0';
+    if (build_level(board) < 0 || build_layers(board) < 0) goto fail;
+    if (brlock_init(&board->state_lock, STATE_LOCK_READERS(board->n_ghosts)) < 0) goto fail;
+    return 0;
+
+fail:
+    free_board(board);
+    if (board->level != NULL) level_release(board->level);
+    return -1;
 }
 
 void open_debug_file(char *filename) {
@@ -533,14 +827,15 @@ void print_board(board_t *board) {
                        "Dimensions: %d x %d\n"
                        "Tempo: %d\n"
                        "Pacman file: %s\n",
-                       getpid(), board->height, board->width, board->tempo, board->pacman_file);
+                       getpid(), board->height, board->width, board->tempo,
+                       board->level->pacman_file != NULL ? board->level->pacman_file : "none");
 
     offset += snprintf(buffer + offset, sizeof(buffer) - offset,
                        "Monster files (%d):\n", board->n_ghosts);
 
-    for (int i = 0; i < board->n_ghosts; i++) {
+    for (int i = 0; board->level->ghosts_files != NULL && board->level->ghosts_files[i] != NULL; i++) {
         offset += snprintf(buffer + offset, sizeof(buffer) - offset,
-                           "  - %s\n", board->ghosts_files[i]);
+                           "  - %s\n", board->level->ghosts_files[i]);
     }
 
     offset += snprintf(buffer + offset, sizeof(buffer) - offset, "\n=== BOARD ===\n");
@@ -549,7 +844,7 @@ void print_board(board_t *board) {
         for (int x = 0; x < board->width; x++) {
             int idx = y * board->width + x;
             if (offset < sizeof(buffer) - 2) {
-                buffer[offset++] = board->board[idx].content;
+                buffer[offset++] = cell_content(&board->board[idx]);
             }
         }
         if (offset < sizeof(buffer) - 2) {
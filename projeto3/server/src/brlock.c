@@ -0,0 +1,60 @@
+#include "brlock.h"
+#include <stdlib.h>
+#include <sched.h>
+
+int brlock_init(brlock_t* lock, int n_readers) {
+    // the writer flag takes the first slot, the struct holding the lock may sit anywhere
+    lock->writer = aligned_alloc(CACHE_LINE_SIZE, (n_readers + 1) * sizeof(brlock_slot_t));
+    if (lock->writer == NULL) return -1;
+
+    for (int i = 0; i <= n_readers; i++) {
+        atomic_init(&lock->writer[i].active, false);
+    }
+    lock->slots = lock->writer + 1;
+    lock->n_readers = n_readers;
+    pthread_mutex_init(&lock->writer_lock, NULL);
+    return 0;
+}
+
+void brlock_destroy(brlock_t* lock) {
+    pthread_mutex_destroy(&lock->writer_lock);
+    free(lock->writer);
+    lock->writer = NULL;
+    lock->slots = NULL;
+}
+
+void brlock_read_lock(brlock_t* lock, int reader) {
+    brlock_slot_t* slot = &lock->slots[reader];
+
+    while (true) {
+        // announce first, then look: a writer does the opposite, so one of both always sees the other
+        atomic_store(&slot->active, true);
+        if (!atomic_load(&lock->writer->active)) return;
+
+        // back off until the writer is done
+        atomic_store_explicit(&slot->active, false, memory_order_release);
+        while (atomic_load_explicit(&lock->writer->active, memory_order_acquire)) {
+            sched_yield();
+        }
+    }
+}
+
+void brlock_read_unlock(brlock_t* lock, int reader) {
+    atomic_store_explicit(&lock->slots[reader].active, false, memory_order_release);
+}
+
+void brlock_write_lock(brlock_t* lock) {
+    pthread_mutex_lock(&lock->writer_lock);
+    atomic_store(&lock->writer->active, true);
+
+    for (int i = 0; i < lock->n_readers; i++) {
+        while (atomic_load(&lock->slots[i].active)) {
+            sched_yield();
+        }
+    }
+}
+
+void brlock_write_unlock(brlock_t* lock) {
+    atomic_store_explicit(&lock->writer->active, false, memory_order_release);
+    pthread_mutex_unlock(&lock->writer_lock);
+}
@@ -0,0 +1,344 @@
+#include "catalog.h"
+#include "levelfile.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <dirent.h>
+#include <errno.h>
+#include <poll.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <sys/eventfd.h>
+#include <sys/inotify.h>
+#include <sys/stat.h>
+
+// Helper private function, qsort order of the level file names
+static int compare_names(const void* a, const void* b) {
+    return strcmp(*(char* const*) a, *(char* const*) b);
+}
+
+// Helper private function, names of the levels of a directory, as text, compiled or both, without the extension and sorted, -1 if it can't be read
+static int list_levels(char* dirname, char*** names) {
+    DIR* level_dir = opendir(dirname);
+    if (level_dir == NULL) return -1;
+
+    int n_names = 0;
+    *names = NULL;
+    struct dirent* entry;
+    while ((entry = readdir(level_dir)) != NULL) {
+        if (entry->d_name[0] == '.') continue;
+        char *dot = strrchr(entry->d_name, '.');
+        if (!dot || (strcmp(dot, ".lvl") != 0 && strcmp(dot, LEVEL_FILE_EXTENSION) != 0)) continue;
+
+        char* name = strndup(entry->d_name, dot - entry->d_name);
+        char** grown = name != NULL ? realloc(*names, (n_names + 1) * sizeof(char*)) : NULL;
+        if (grown == NULL) {
+            free(name);
+            break;
+        }
+        *names = grown;
+        (*names)[n_names++] = name;
+    }
+    closedir(level_dir);
+
+    // the text and the compiled form of a level come out next to each other
+    if (n_names > 0) qsort(*names, n_names, sizeof(char*), compare_names);
+    int n_unique = 0;
+    for (int i = 0; i < n_names; i++) {
+        if (n_unique > 0 && strcmp((*names)[i], (*names)[n_unique - 1]) == 0) {
+            free((*names)[i]);
+            continue;
+        }
+        (*names)[n_unique++] = (*names)[i];
+    }
+    return n_unique;
+}
+
+// Helper private function, whether a was modified after b
+static bool newer(struct timespec a, struct timespec b) {
+    return a.tv_sec > b.tv_sec || (a.tv_sec == b.tv_sec && a.tv_nsec > b.tv_nsec);
+}
+
+// Helper private function, whether a pacman or ghost file of a level was modified after compiled, missing ones are left to the compiled copy
+static bool scripts_newer(level_t* level, struct timespec compiled) {
+    struct stat st;
+    if (level->pacman_file != NULL && stat(level->pacman_file, &st) == 0 && newer(st.st_mtim, compiled)) return true;
+    for (int i = 0; level->ghosts_files != NULL && level->ghosts_files[i] != NULL; i++) {
+        if (stat(level->ghosts_files[i], &st) == 0 && newer(st.st_mtim, compiled)) return true;
+    }
+    return false;
+}
+
+// Helper private function, maps the compiled form of a level unless its text or scripts were changed after it was compiled, else parses the text
+static level_t* load_catalog_level(char* dirname, char* name) {
+    char* filename = malloc(strlen(name) + strlen(LEVEL_FILE_EXTENSION) + 1);
+    char* compiled = malloc(strlen(dirname) + strlen(name) + strlen(LEVEL_FILE_EXTENSION) + 2);
+    char* text = malloc(strlen(dirname) + strlen(name) + 6);
+    if (filename == NULL || compiled == NULL || text == NULL) {
+        free(filename);
+        free(compiled);
+        free(text);
+        return NULL;
+    }
+    sprintf(compiled, "%s/%s%s", dirname, name, LEVEL_FILE_EXTENSION);
+    sprintf(text, "%s/%s.lvl", dirname, name);
+
+    struct stat compiled_st, text_st;
+    bool has_text = stat(text, &text_st) == 0;
+    level_t* level = NULL;
+    if (stat(compiled, &compiled_st) == 0 && (!has_text || !newer(text_st.st_mtim, compiled_st.st_mtim))) {
+        level = level_map(compiled, name);
+        if (level != NULL && scripts_newer(level, compiled_st.st_mtim)) {
+            debug("%s is older than the scripts it was compiled from\n", compiled);
+            level_release(level);
+            level = NULL;
+        }
+        if (level != NULL) debug("Level %s mapped from %s\n", name, compiled);
+    }
+    if (level == NULL && has_text) {
+        sprintf(filename, "%s.lvl", name);
+        level = level_parse(filename, dirname);
+    }
+
+    free(filename);
+    free(compiled);
+    free(text);
+    return level;
+}
+
+// Helper private function, whether a file is gone or was changed at or after since, renames included
+static bool file_changed(char* path, struct timespec since) {
+    struct stat st;
+    return stat(path, &st) < 0 || !newer(since, st.st_ctim);
+}
+
+// Helper private function, whether a pacman or ghost file of a level changed, a compiled level does without the missing ones
+static bool script_changed(level_t* level, char* path, struct timespec since) {
+    struct stat st;
+    if (stat(path, &st) < 0) return level->map == NULL;
+    return !newer(since, st.st_ctim);
+}
+
+// Helper private function, whether a level of the previous version has to be read again
+static bool level_changed(char* dirname, level_t* level, struct timespec since) {
+    if (file_changed(level->path, since)) return true;
+
+    // compiled levels name the scripts they were built from too
+    if (level->pacman_file != NULL && script_changed(level, level->pacman_file, since)) return true;
+    for (int i = 0; level->ghosts_files != NULL && level->ghosts_files[i] != NULL; i++) {
+        if (script_changed(level, level->ghosts_files[i], since)) return true;
+    }
+
+    // the other form of the level appearing or changing decides again which one is read
+    char* other = malloc(strlen(dirname) + strlen(level->name) + strlen(LEVEL_FILE_EXTENSION) + 6);
+    if (other == NULL) return true;
+    sprintf(other, "%s/%s%s", dirname, level->name, level->map != NULL ? ".lvl" : LEVEL_FILE_EXTENSION);
+    struct stat st;
+    bool changed = stat(other, &st) == 0 && !newer(since, st.st_ctim);
+    free(other);
+    return changed;
+}
+
+// Helper private function, the levels of dirname as the version after previous, reusing its levels that did not change
+static catalog_t* build_catalog(char* dirname, catalog_t* previous) {
+    struct timespec built;
+    clock_gettime(CLOCK_REALTIME, &built);
+
+    char** names;
+    int n_names = list_levels(dirname, &names);
+    if (n_names < 0) return NULL;
+
+    catalog_t* catalog = malloc(sizeof(catalog_t));
+    level_t** levels = malloc((n_names + 1) * sizeof(level_t*));
+    if (catalog == NULL || levels == NULL) {
+        for (int i = 0; i < n_names; i++) free(names[i]);
+        free(names);
+        free(catalog);
+        free(levels);
+        return NULL;
+    }
+    atomic_init(&catalog->refs, 1);
+    catalog->version = previous != NULL ? previous->version + 1 : 1;
+    catalog->built = built;
+    catalog->n_levels = 0;
+    catalog->levels = levels;
+
+    // file times come from the coarser clock of the kernel, the margin keeps a change made right after the last build
+    struct timespec since = previous != NULL ? previous->built : built;
+    since.tv_nsec -= CATALOG_CLOCK_MARGIN_MS * 1000000L;
+    if (since.tv_nsec < 0) {
+        since.tv_sec--;
+        since.tv_nsec += 1000000000L;
+    }
+
+    int n_read = 0;
+    int j = 0;
+    for (int i = 0; i < n_names; i++) {
+        // both versions are sorted by name
+        while (previous != NULL && j < previous->n_levels && strcmp(previous->levels[j]->name, names[i]) < 0) j++;
+        level_t* old = NULL;
+        if (previous != NULL && j < previous->n_levels && strcmp(previous->levels[j]->name, names[i]) == 0) {
+            old = previous->levels[j];
+        }
+
+        level_t* level = NULL;
+        bool changed = old == NULL || level_changed(dirname, old, since);
+        if (changed) {
+            level = load_catalog_level(dirname, names[i]);
+            n_read++;
+        }
+        if (level == NULL && old != NULL) {
+            // a file caught half written keeps the level as it was, the end of the write brings another version
+            if (changed) fprintf(stderr, "Keeping the previous %s/%s\n", dirname, names[i]);
+            atomic_fetch_add(&old->refs, 1);
+            level = old;
+        }
+
+        if (level != NULL) {
+            catalog->levels[catalog->n_levels++] = level;
+        } else {
+            fprintf(stderr, "Skipping level %s/%s\n", dirname, names[i]);
+        }
+        free(names[i]);
+    }
+    free(names);
+
+    debug("Catalog version %lu of %s has %d levels, %d read from disk\n", catalog->version, dirname, catalog->n_levels, n_read);
+    return catalog;
+}
+
+static char* catalog_dir = NULL;
+static catalog_t* current = NULL;
+static pthread_mutex_t current_lock = PTHREAD_MUTEX_INITIALIZER; // taken only to swap or take a reference to current
+static bool watching = false;
+static pthread_t watch_tid;
+static int watch_fd = -1; // inotify on catalog_dir
+static int stop_fd = -1; // eventfd signalled by catalog_close
+
+// Helper private function, makes catalog the version games start on from now on
+static void publish(catalog_t* catalog) {
+    pthread_mutex_lock(&current_lock);
+    catalog_t* old = current;
+    current = catalog;
+    pthread_mutex_unlock(&current_lock);
+
+    // games started on the old one keep it alive until they end
+    if (old != NULL) catalog_release(old);
+}
+
+// Helper private function, whether two versions have the very same levels
+static bool same_levels(catalog_t* a, catalog_t* b) {
+    if (a->n_levels != b->n_levels) return false;
+    for (int i = 0; i < a->n_levels; i++) {
+        if (a->levels[i] != b->levels[i]) return false;
+    }
+    return true;
+}
+
+// Helper private function, builds the next version and publishes it unless no level changed
+static void reload() {
+    catalog_t* previous = catalog_acquire();
+    catalog_t* next = build_catalog(catalog_dir, previous);
+    if (next != NULL && same_levels(previous, next)) {
+        catalog_release(next);
+    } else if (next != NULL) {
+        debug("Publishing catalog version %lu\n", next->version);
+        publish(next);
+    }
+    catalog_release(previous);
+}
+
+static void* watch_thread(void* arg) {
+    (void) arg;
+    _Alignas(struct inotify_event) char buffer[4096];
+    struct pollfd fds[2] = {{.fd = watch_fd, .events = POLLIN}, {.fd = stop_fd, .events = POLLIN}};
+
+    // what changed before the watch started is caught up with first
+    bool pending = true;
+    while (true) {
+        // a burst of events, a file being written or a level along with its scripts, is read once it settles
+        int ready = poll(fds, 2, pending ? CATALOG_SETTLE_MS : -1);
+        if (ready < 0 && errno == EINTR) continue;
+        if (ready < 0 || (fds[1].revents & POLLIN)) break;
+
+        if (ready == 0) {
+            reload();
+            pending = false;
+        } else if (read(watch_fd, buffer, sizeof(buffer)) > 0) {
+            pending = true;
+        }
+    }
+    return NULL;
+}
+
+int catalog_open(char* dirname) {
+    catalog_dir = strdup(dirname);
+    catalog_t* catalog = catalog_dir != NULL ? build_catalog(catalog_dir, NULL) : NULL;
+    if (catalog == NULL) return -1;
+    publish(catalog);
+    return 0;
+}
+
+int catalog_watch() {
+    watch_fd = inotify_init1(IN_CLOEXEC);
+    if (watch_fd < 0) return -1;
+
+    uint32_t events = IN_CLOSE_WRITE | IN_MOVED_TO | IN_MOVED_FROM | IN_DELETE | IN_ATTRIB;
+    if (inotify_add_watch(watch_fd, catalog_dir, events) < 0 || (stop_fd = eventfd(0, EFD_CLOEXEC)) < 0) {
+        close(watch_fd);
+        watch_fd = -1;
+        return -1;
+    }
+    if (pthread_create(&watch_tid, NULL, watch_thread, NULL) != 0) {
+        close(watch_fd);
+        close(stop_fd);
+        watch_fd = stop_fd = -1;
+        return -1;
+    }
+    watching = true;
+    return 0;
+}
+
+catalog_t* catalog_acquire() {
+    pthread_mutex_lock(&current_lock);
+    catalog_t* catalog = current;
+    atomic_fetch_add(&catalog->refs, 1);
+    pthread_mutex_unlock(&current_lock);
+    return catalog;
+}
+
+void catalog_release(catalog_t* catalog) {
+    if (atomic_fetch_sub(&catalog->refs, 1) > 1) return;
+
+    for (int i = 0; i < catalog->n_levels; i++) {
+        level_release(catalog->levels[i]);
+    }
+    free(catalog->levels);
+    free(catalog);
+}
+
+level_t* catalog_level(catalog_t* catalog, int index) {
+    if (index < 0 || index >= catalog->n_levels) return NULL;
+    return catalog->levels[index];
+}
+
+int catalog_level_after(catalog_t* catalog, const char* name) {
+    int index = 0;
+    while (index < catalog->n_levels && strcmp(catalog->levels[index]->name, name) <= 0) index++;
+    return index;
+}
+
+void catalog_close() {
+    if (watching) {
+        uint64_t one = 1;
+        write(stop_fd, &one, sizeof(one));
+        pthread_join(watch_tid, NULL);
+        close(watch_fd);
+        close(stop_fd);
+        watching = false;
+    }
+
+    publish(NULL);
+    free(catalog_dir);
+    catalog_dir = NULL;
+}
@@ -63,7 +63,7 @@ void draw_board(board_t* board, int mode) {
         break;
 
     case DRAW_MENU:
-        mvprintw(1, 0, "Level: %s | Use W/A/S/D to move | Q to quit | G to quicksave ", board->level_name);
+        mvprintw(1, 0, "Level: %s | Use W/A/S/D to move | Q to quit | G to quicksave ", board->level->name);
         break;
     }
 
@@ -75,54 +75,48 @@ void draw_board(board_t* board, int mode) {
     for (int y = 0; y < board->height; y++) {
         for (int x = 0; x < board->width; x++) {
             int index = y * board->width + x;
-            char ch = board->board[index].content;
-            int ghost_charged = 0;
-
-            for (int g = 0; g < board->n_ghosts; g++) {
-                ghost_t* ghost = &board->ghosts[g];
-                if (ghost->pos_x == x && ghost->pos_y == y) {
-                    if (ghost->charged)
-                        ghost_charged = 1;
-                    break;
-                }
-            }
+            char ch = cell_glyph(&board->board[index]);
 
             // Move cursor to position
             move(start_row + y, x);
 
             // Draw with appropriate color
             switch (ch) {
-                case 'W': // Wall
+                case 'X': // Wall
                     attron(COLOR_PAIR(3));
                     addch('#');
                     attroff(COLOR_PAIR(3));
                     break;
 
-                case 'P': // Pacman
+                case 'C': // Pacman
                     attron(COLOR_PAIR(1) | A_BOLD);
                     addch('C');
                     attroff(COLOR_PAIR(1) | A_BOLD);
                     break;
 
-                case 'M': // Monster/Ghost
+                case 'M': { // Monster/Ghost
+                    int g = cell_occupant(board, index);
+                    int ghost_charged = g >= 0 && g < board->n_ghosts && board->ghosts[g].charged;
                     attron((COLOR_PAIR(2) | A_BOLD) | ((ghost_charged) ? (A_DIM) : (0)));
                     addch('M');
                     attroff((COLOR_PAIR(2) | A_BOLD) | ((ghost_charged) ? (A_DIM) : (0)));
                     break;
+                }
+
+                case '@': // Portal
+                    attron(COLOR_PAIR(6));
+                    addch('@');
+                    attroff(COLOR_PAIR(6));
+                    break;
+
+                case '.': // Dot
+                    attron(COLOR_PAIR(4));
+                    addch('.');
+                    attroff(COLOR_PAIR(4));
+                    break;
 
                 case ' ': // Empty space
-                    if (board->board[index].has_portal) {
-                        attron(COLOR_PAIR(6));
-                        addch('@');
-                        attroff(COLOR_PAIR(6));
-                    }
-                    else if (board->board[index].has_dot) {
-                        attron(COLOR_PAIR(4));
-                        addch('.');
-                        attroff(COLOR_PAIR(4));
-                    }
-                    else
-                        addch(' ');
+                    addch(' ');
                     break;
 
                 default:
@@ -1,23 +1,28 @@
 #include "board.h"
 #include "display.h"
 #include "protocol.h"
+#include "tick.h"
+#include "reactor.h"
+#include "affinity.h"
+#include "shard.h"
+#include "handoff.h"
+#include "catalog.h"
 #include <stdlib.h>
 #include <string.h>
 #include <time.h>
 #include <sys/types.h>
 #include <sys/stat.h>
 #include <fcntl.h>
-#include <dirent.h>
 #include <unistd.h>
 #include <sys/wait.h>
 #include <pthread.h>
 #include <semaphore.h>
+#include <signal.h>
+#include <errno.h>
 
-#define CONTINUE_PLAY 0
-#define NEXT_LEVEL 1
-#define QUIT_GAME 2
-#define LOAD_BACKUP 3
-#define CREATE_BACKUP 4
+#define ENGINE_THREADS 0 // one thread per entity
+#define ENGINE_TICK 1 // one tick loop per session
+#define ENGINE_REACTOR 2 // every session multiplexed on a pool of epoll workers
 
 
 typedef struct {
@@ -33,38 +38,48 @@ typedef struct {
 } register_queue_t;
 
 client_pipes_t dequeue(register_queue_t* register_queue, pthread_mutex_t* queue_mutex, sem_t* items, sem_t* empty);
-void board_to_message(char *message, board_t* game_board, int victory, int game_over, int accumulated_points);
+
+typedef struct session_threads session_threads_t;
 
 typedef struct {
-    board_t *board;
+    session_threads_t *threads;
     int ghost_index;
 } ghost_thread_arg_t;
 
+// Threads of one session, created once and re-armed for every level
+struct session_threads {
+    pthread_mutex_t lock;
+    pthread_cond_t armed; // a new round started or the session is over
+    pthread_cond_t done; // the pacman has a result or a thread left the round
+    board_t *board; // board of the current round
+    unsigned int round; // bumped every time the threads are re-armed
+    bool stop; // written under board->state_lock, ends the current round
+    bool exit; // the session is over
+    int active; // threads still inside the current round
+    int result; // what ended the round, -1 while still playing
+    int client_request_fd;
+    int client_notification_fd;
+    int* victory;
+    int* game_over;
+    int* accumulated_points;
+    bool started; // pacman and ncurses threads exist
+    pthread_t pacman_tid;
+    pthread_t ncurses_tid;
+    int n_ghost_threads; // ghost threads grow with the biggest level seen
+    pthread_t* ghost_tids; // n_ghost_threads of them
+};
+
 typedef struct {
-    char *level_dir_name;
-    int total_levels;
     register_queue_t *client_queue;
     pthread_mutex_t *queue_mutex;
     sem_t *items;
     sem_t *empty;
     bool* shutdown;
+    int engine;
+    ghost_pool_t* ghost_pool; // tick engine only, NULL when there is a single ghost thread
+    int cpu; // core the session and its threads run on, -1 for anywhere
 } session_thread_arg_t;
 
-typedef struct {
-    board_t *board;
-    int* victory;
-    int* game_over;
-    int* accumulated_points;
-    int client_notification_fd;
-} ncurses_thread_arg_t;
-
-typedef struct {
-    board_t *board;
-    char *client_request_pipe;
-} pacman_thread_arg_t;
-
-int thread_shutdown = 0;
-
 int create_backup() {
     // clear the terminal for process transition
     terminal_cleanup();
@@ -90,211 +105,302 @@ void screen_refresh(board_t * game_board, int mode) {
     refresh_screen();     
 }
 
+// Helper function, parks the calling thread until it takes part in a new round, NULL once the session is over
+static board_t* wait_round(session_threads_t* threads, unsigned int* seen_round, int ghost_index) {
+    board_t* board = NULL;
+
+    pthread_mutex_lock(&threads->lock);
+    while (!threads->exit) {
+        if (threads->round != *seen_round) {
+            *seen_round = threads->round;
+            // ghosts beyond the ones of this level sit the round out
+            if (ghost_index < threads->board->n_ghosts) {
+                board = threads->board;
+                break;
+            }
+        }
+        pthread_cond_wait(&threads->armed, &threads->lock);
+    }
+    pthread_mutex_unlock(&threads->lock);
+    return board;
+}
+
+// Helper function, called by every thread when its part of the round is over
+static void leave_round(session_threads_t* threads) {
+    pthread_mutex_lock(&threads->lock);
+    threads->active--;
+    pthread_cond_signal(&threads->done);
+    pthread_mutex_unlock(&threads->lock);
+}
+
 void* ncurses_thread(void *arg) {
-    ncurses_thread_arg_t *ncurses_arg = (ncurses_thread_arg_t*) arg;
-    board_t *board = ncurses_arg->board;
-    int* victory = ncurses_arg->victory;
-    int* game_over = ncurses_arg->game_over;
-    int* accumulated_points = ncurses_arg->accumulated_points;
-    int client_notification_fd = ncurses_arg->client_notification_fd;
+    session_threads_t *threads = (session_threads_t*) arg;
+    unsigned int seen_round = 0;
+    board_t *board;
 
-    free(ncurses_arg);
+    while ((board = wait_round(threads, &seen_round, -1)) != NULL) {
+        deadline_t deadline;
+        deadline_start(&deadline);
 
-    while (board->session_active) {
-        sleep_ms(board->tempo);
-        int data_size = sizeof(char) + (sizeof(int)*6) + (sizeof(char)* board->width * board->height);
-        char message[data_size];
+        while (true) {
+            int missed = deadline_wait(&deadline, board->tempo);
+            if (missed > 0) debug("Display missed %d frame deadlines\n", missed);
+            int data_size = board_message_size(board);
+            char message[data_size];
 
-        board_to_message(message, board, *victory, *game_over, *accumulated_points);
+            brlock_read_lock(&board->state_lock, READER_DISPLAY);
+            if (threads->stop) {
+                brlock_read_unlock(&board->state_lock, READER_DISPLAY);
+                break;
+            }
+            board_to_message(message, board, *threads->victory, *threads->game_over, *threads->accumulated_points);
+            brlock_read_unlock(&board->state_lock, READER_DISPLAY);
 
-        debug("WRITING IN: %d\n", client_notification_fd);
-        write_full(client_notification_fd, message, data_size);
+            debug("WRITING IN: %d\n", threads->client_notification_fd);
+            write_full(threads->client_notification_fd, message, data_size);
+        }
+        leave_round(threads);
     }
     return NULL;
 }
 
-void* pacman_thread(void *arg) {
-    pacman_thread_arg_t *pacman_arg = (pacman_thread_arg_t*) arg;
-
-    board_t *board = pacman_arg->board;
-    char *client_request_pipe = pacman_arg->client_request_pipe;
-
+// Helper function, plays the client commands until one of them ends the level
+static int play_pacman(session_threads_t* threads, board_t* board) {
     pacman_t* pacman = &board->pacmans[0];
-    debug("PACMAN THREAD\n");
-
-    int *retval = malloc(sizeof(int));
-
-    int client_request_fd = open(client_request_pipe, O_RDWR);
+    int client_request_fd = threads->client_request_fd;
+    deadline_t deadline;
+    deadline_start(&deadline);
 
     while (true) {
         if(!pacman->alive) {
-            *retval = LOAD_BACKUP;
-            return (void*) retval;
+            return LOAD_BACKUP;
         }
 
-        sleep_ms(board->tempo * (1 + pacman->passo));
+        // paced by the client as well, so deadlines spent waiting for a command are not reported
+        deadline_wait(&deadline, board->tempo * (1 + pacman->passo));
 
         char buffer[1];
-        read_full(client_request_fd, buffer, 1);
+        if (read_full(client_request_fd, buffer, 1) < 0) return QUIT_GAME;
         int op_code = buffer[0] - '0';
         debug("OPCODE FROM PLAY %c\n", buffer[0]);
         if(op_code == OP_CODE_DISCONNECT){
             debug("Receiving disconnect message (1 bytes): op=%c\n", buffer[0]);
-            *retval = QUIT_GAME;
-            close(client_request_fd);
-            return (void*) retval;
+            return QUIT_GAME;
         }
-        read_full(client_request_fd, buffer, 1);
+        if (read_full(client_request_fd, buffer, 1) < 0) return QUIT_GAME;
         debug("COMMAND FROM PLAY %c\n", buffer[0]);
-        debug("comand read\n");
         char command = buffer[0];
         debug("Receiving play message (2 bytes): op=%d command=%c\n", op_code, command);
 
-        command_t* play;
-        command_t c;
+        command_t play;
+        play.command = command;
+        play.turns = 1;
+        play.turns_left = 1;
 
-        c.command = command;
-        c.turns = 1;
-        play = &c;
-
-
-        debug("KEY %c\n", play->command);
+        debug("KEY %c\n", play.command);
 
         // QUIT
-        if (play->command == 'Q') {
-            *retval = QUIT_GAME;
-            close(client_request_fd);
-            return (void*) retval;
+        if (play.command == 'Q') {
+            return QUIT_GAME;
         }
         // FORK
-        if (play->command == 'G') {
-            *retval = CREATE_BACKUP;
-            close(client_request_fd);
-            return (void*) retval;
+        if (play.command == 'G') {
+            return CREATE_BACKUP;
         }
 
-        pthread_rwlock_rdlock(&board->state_lock);
+        brlock_read_lock(&board->state_lock, READER_PACMAN);
+        int result = move_pacman(board, 0, &play);
+        brlock_read_unlock(&board->state_lock, READER_PACMAN);
+
+        *threads->accumulated_points = pacman->points;
 
-        int result = move_pacman(board, 0, play);
-        if (result == REACHED_PORTAL) {
+        if (result == REACHED_PORTAL || result == LEVEL_CLEARED) {
             // Next level
-            *retval = NEXT_LEVEL;
-            break;
+            return NEXT_LEVEL;
         }
-        else if(result == DEAD_PACMAN) {
+        if (result == DEAD_PACMAN) {
             // Restart from child, wait for child, then quit
-            *retval = LOAD_BACKUP;
-            break;
-        }
-        else{
-            *retval = CONTINUE_PLAY;
-            break;
+            return LOAD_BACKUP;
         }
+    }
+}
 
-        pthread_rwlock_unlock(&board->state_lock);
+void* pacman_thread(void *arg) {
+    session_threads_t *threads = (session_threads_t*) arg;
+    unsigned int seen_round = 0;
+    board_t *board;
+
+    debug("PACMAN THREAD\n");
+    while ((board = wait_round(threads, &seen_round, -1)) != NULL) {
+        int result = play_pacman(threads, board);
+
+        pthread_mutex_lock(&threads->lock);
+        threads->result = result;
+        threads->active--;
+        pthread_cond_signal(&threads->done);
+        pthread_mutex_unlock(&threads->lock);
     }
-    pthread_rwlock_unlock(&board->state_lock);
-    close(client_request_fd);
-    return (void*) retval;
+    return NULL;
 }
 
 void* ghost_thread(void *arg) {
     ghost_thread_arg_t *ghost_arg = (ghost_thread_arg_t*) arg;
-    board_t *board = ghost_arg->board;
+    session_threads_t *threads = ghost_arg->threads;
     int ghost_ind = ghost_arg->ghost_index;
-
     free(ghost_arg);
+    unsigned int seen_round = 0;
+    board_t *board;
 
-    ghost_t* ghost = &board->ghosts[ghost_ind];
+    while ((board = wait_round(threads, &seen_round, ghost_ind)) != NULL) {
+        ghost_t* ghost = &board->ghosts[ghost_ind];
+        deadline_t deadline;
+        deadline_start(&deadline);
 
-    while (true) {
-        sleep_ms(board->tempo * (1 + ghost->passo));
+        while (true) {
+            int missed = deadline_wait(&deadline, board->tempo * (1 + ghost->passo));
+            if (missed > 0) debug("Ghost %d missed %d move deadlines\n", ghost_ind, missed);
 
-        pthread_rwlock_rdlock(&board->state_lock);
-        if (thread_shutdown) {
-            pthread_rwlock_unlock(&board->state_lock);
-            pthread_exit(NULL);
+            brlock_read_lock(&board->state_lock, READER_GHOST(ghost_ind));
+            if (threads->stop) {
+                brlock_read_unlock(&board->state_lock, READER_GHOST(ghost_ind));
+                break;
+            }
+
+            if (ghost->n_moves > 0) {
+                move_ghost(board, ghost_ind, ghost_command(board, ghost_ind));
+            }
+            brlock_read_unlock(&board->state_lock, READER_GHOST(ghost_ind));
         }
-        
-        move_ghost(board, ghost_ind, &ghost->moves[ghost->current_move%ghost->n_moves]);
-        pthread_rwlock_unlock(&board->state_lock);
+        leave_round(threads);
     }
+    return NULL;
 }
 
-void board_to_message(char *message, board_t* game_board, int victory, int game_over, int accumulated_points) {
-    int data_size = sizeof(char) + (sizeof(int)*6) + (sizeof(char)* game_board->width * game_board->height);
-    char *ptr = message;
-
-    // op_code (1 byte)
-    ptr[0] = (char)('0' + OP_CODE_BOARD); //OP_CODE_BOARD
-    ptr += 1;
-
-    // width
-    memcpy(ptr, &game_board->width, sizeof(int));
-    ptr += sizeof(int);
-
-    // height
-    memcpy(ptr, &game_board->height, sizeof(int));
-    ptr += sizeof(int);
-
-    // tempo
-    memcpy(ptr, &game_board->tempo, sizeof(int));
-    ptr += sizeof(int);
-
-    // victory
-    int vic = victory;
-    memcpy(ptr, &vic, sizeof(int));
-    ptr += sizeof(int);
-
-    // game_over
-    int eg = game_over;
-    memcpy(ptr, &eg, sizeof(int));
-    ptr += sizeof(int);
-
-    // accumulated_points
-    memcpy(ptr, &accumulated_points, sizeof(int));
-    ptr += sizeof(int);
-
-    // board data (width * height bytes)
-    //memcpy(ptr, game_board->board, game_board->width * game_board->height);
-    for (int i = 0; i < game_board->width * game_board->height; i++) {
-        switch(game_board->board[i].content) {
-            case 'W':
-                ptr[i] = 'X';
-                break;
-            case 'P':
-                ptr[i] = 'C';
-                break;
-            case 'M':
-                ptr[i] = 'M';
-                break;
-            default:
-                if (game_board->board[i].has_dot) {
-                    ptr[i] = '.';
-                } else if (game_board->board[i].has_portal) {
-                    ptr[i] = '@';
-                } else {
-                    ptr[i] = ' ';
-                }
-                break;
-        }
+static void session_threads_init(session_threads_t* threads, int client_request_fd, int client_notification_fd, int* victory, int* game_over, int* accumulated_points) {
+    pthread_mutex_init(&threads->lock, NULL);
+    pthread_cond_init(&threads->armed, NULL);
+    pthread_cond_init(&threads->done, NULL);
+    threads->board = NULL;
+    threads->round = 0;
+    threads->stop = false;
+    threads->exit = false;
+    threads->active = 0;
+    threads->result = -1;
+    threads->client_request_fd = client_request_fd;
+    threads->client_notification_fd = client_notification_fd;
+    threads->victory = victory;
+    threads->game_over = game_over;
+    threads->accumulated_points = accumulated_points;
+    threads->started = false;
+    threads->n_ghost_threads = 0;
+    threads->ghost_tids = NULL;
+}
+
+// Only the forking thread survives in the child, its copy starts again with no threads
+static void session_threads_after_fork(session_threads_t* threads) {
+    free(threads->ghost_tids);
+    session_threads_init(threads, threads->client_request_fd, threads->client_notification_fd,
+                         threads->victory, threads->game_over, threads->accumulated_points);
+}
+
+static void session_threads_destroy(session_threads_t* threads) {
+    pthread_mutex_lock(&threads->lock);
+    threads->exit = true;
+    pthread_cond_broadcast(&threads->armed);
+    pthread_mutex_unlock(&threads->lock);
+
+    if (threads->started) {
+        pthread_join(threads->pacman_tid, NULL);
+        pthread_join(threads->ncurses_tid, NULL);
     }
+    for (int i = 0; i < threads->n_ghost_threads; i++) {
+        pthread_join(threads->ghost_tids[i], NULL);
+    }
+    free(threads->ghost_tids);
 
+    pthread_cond_destroy(&threads->armed);
+    pthread_cond_destroy(&threads->done);
+    pthread_mutex_destroy(&threads->lock);
+}
 
-    debug("Sending update message to notifications (%d bytes): op=%c width=%d height=%d tempo: %d victory: %d game_over: %d accumulated_points: %d\n", data_size, message[0], game_board->width, game_board->height, game_board->tempo, vic, eg, accumulated_points);
-    for (int lin = 0; lin < game_board->height; lin++) {
-        for (int col = 0; col < game_board->width; col++) {
-            debug("%c", game_board->board[lin * game_board->width + col].content);
+// Plays until the level ends, re-arming the session threads with the board
+static int play_level_threads(session_threads_t* threads, board_t* board) {
+    if (!threads->started) {
+        debug("Creating threads\n");
+        pthread_create(&threads->pacman_tid, NULL, pacman_thread, threads);
+        pthread_create(&threads->ncurses_tid, NULL, ncurses_thread, threads);
+        threads->started = true;
+    }
+    if (threads->n_ghost_threads < board->n_ghosts) {
+        pthread_t* tids = realloc(threads->ghost_tids, board->n_ghosts * sizeof(pthread_t));
+        if (tids == NULL) {
+            perror("realloc");
+            return QUIT_GAME;
         }
-        debug("\n");
+        threads->ghost_tids = tids;
     }
+    while (threads->n_ghost_threads < board->n_ghosts) {
+        // each ghost thread frees its own argument once it has read it
+        ghost_thread_arg_t* ghost_arg = malloc(sizeof(ghost_thread_arg_t));
+        if (ghost_arg == NULL) {
+            perror("malloc");
+            return QUIT_GAME;
+        }
+        int i = threads->n_ghost_threads++;
+        ghost_arg->threads = threads;
+        ghost_arg->ghost_index = i;
+        pthread_create(&threads->ghost_tids[i], NULL, ghost_thread, ghost_arg);
+    }
+
+    pthread_mutex_lock(&threads->lock);
+    threads->board = board;
+    threads->stop = false;
+    threads->result = -1;
+    threads->active = 2 + board->n_ghosts; // pacman, ncurses and this level's ghosts
+    threads->round++;
+    pthread_cond_broadcast(&threads->armed);
+
+    while (threads->result < 0) {
+        pthread_cond_wait(&threads->done, &threads->lock);
+    }
+    int result = threads->result;
+    pthread_mutex_unlock(&threads->lock);
+    debug("Pacman round over\n");
+
+    brlock_write_lock(&board->state_lock);
+    threads->stop = true;
+    brlock_write_unlock(&board->state_lock);
+
+    // every thread parks again before the board can be unloaded
+    pthread_mutex_lock(&threads->lock);
+    while (threads->active > 0) {
+        pthread_cond_wait(&threads->done, &threads->lock);
+    }
+    pthread_mutex_unlock(&threads->lock);
+    debug("Ghost threads parked\n");
+
+    return result;
+}
+
+// Plays until the level ends with a single tick loop driving every entity
+static int play_level_tick(tick_session_t* session, board_t* board) {
+    int result;
+    deadline_t deadline;
+
+    tick_start_level(session, board);
+    deadline_start(&deadline);
+    do {
+        int missed = deadline_wait(&deadline, board->tempo);
+        if (missed > 0) debug("Tick %lu came after %d missed deadlines\n", session->tick, missed);
+        result = tick_advance(session);
+    } while (result == CONTINUE_PLAY);
+
+    return result;
 }
 
 void* individual_session_thread(void *session_args) {
     session_thread_arg_t *thread_arg = (session_thread_arg_t *) session_args;
     
-    char *level_dir_name = thread_arg->level_dir_name;
-    int total_levels = thread_arg->total_levels;
     register_queue_t* client_queue = thread_arg->client_queue;
     pthread_mutex_t* queue_mutex = thread_arg->queue_mutex;
     sem_t* items = thread_arg->items;
@@ -302,10 +408,15 @@ void* individual_session_thread(void *session_args) {
     client_pipes_t client_pipe_data;
 
     debug("INDIVIDUAL SESSION THREAD\n");
+    // pacman, ghost and ncurses threads inherit the core
+    affinity_pin(thread_arg->cpu);
 
    
 
-    struct dirent* entry;
+    // everything a session allocates comes from here, given back level by level and client by client
+    arena_t arena;
+    arena_init(&arena, ARENA_BLOCK_SIZE);
+
     // o servidor deve quando não tem um cliente esperar por um, e quando o cliente desconecta ou o jogo acaba, voltar a esperar por outro cliente
     //implica reiniciar o processamento do jogo
     
@@ -317,8 +428,9 @@ void* individual_session_thread(void *session_args) {
         client_pipe_data = dequeue(client_queue, queue_mutex, items, empty);
         debug("=======Client connected: req=%s, notif=%s\n", client_pipe_data.client_request_pipe, client_pipe_data.client_notification_pipe);
         if (*thread_arg->shutdown) break;
-        char* client_request_pipe = strdup(client_pipe_data.client_request_pipe);
-        char* client_notification_pipe = strdup(client_pipe_data.client_notification_pipe);
+        arena_reset(&arena);
+        char* client_request_pipe = arena_strdup(&arena, client_pipe_data.client_request_pipe);
+        char* client_notification_pipe = arena_strdup(&arena, client_pipe_data.client_notification_pipe);
 
         char message[2];
         message[0] = (char)('0' + OP_CODE_CONNECT);
@@ -327,12 +439,17 @@ void* individual_session_thread(void *session_args) {
         if (client_notification_fd < 0) {
             perror("open client fifo");
             message[1] = '1';// ele nunca escreve a mensagem de erro, na variavel message
+            shard_session_done();
             continue;
         }
         message[1] = '0'; 
         debug("Sending return message to connect (2 bytes): op=%c result=%c\n", message[0], message[1]);
         write_full(client_notification_fd, message, sizeof(message));
 
+        // every random move of the session comes from this seed, -s replays it
+        uint64_t session_seed = rng_session_seed();
+        debug("Session of %s seeded with %llu\n", client_notification_pipe, (unsigned long long) session_seed);
+
         int accumulated_points = 0;
         int end_game = 0;
         int victory = 0;
@@ -340,230 +457,167 @@ void* individual_session_thread(void *session_args) {
         int current_level = 0;
         board_t game_board;
 
-        pid_t parent_process = getpid(); // Only the parent process can create backups
-        
-        DIR* level_dir = opendir(level_dir_name);
-        if (level_dir == NULL) {
-            perror("opendir");
+        // the request pipe stays open for the whole session, the tick engine never blocks on it
+        int request_flags = O_RDWR;
+        if (thread_arg->engine == ENGINE_TICK) request_flags |= O_NONBLOCK;
+        int client_request_fd = open(client_request_pipe, request_flags);
+        if (client_request_fd < 0) {
+            perror("open client request fifo");
             close(client_notification_fd);
-            free(client_request_pipe);
-            free(client_notification_pipe);
+            shard_session_done();
             continue;
         }
 
-        while ((entry = readdir(level_dir)) != NULL) { // o loop nao pode acabar quando o jogo acaba, tem de esperar por outro cliente
-            if (entry->d_name[0] == '.') continue;
-            // tem de esperar por cliente
-            char *dot = strrchr(entry->d_name, '.');
-            if (!dot) continue;
-
-            if (current_level >= total_levels || end_game) {
-                rewinddir(level_dir);
-                current_level = 0;
-                accumulated_points = 0;
-                victory = 0;
-                game_over = 0;
-                end_game = 0;
-                continue;
-            }
-            if (strcmp(dot, ".lvl") == 0) {
-                load_level(&game_board, entry->d_name, level_dir_name, accumulated_points);
-                current_level++;
-            
-                //int data_size = sizeof(char) + (sizeof(int)*6) + (sizeof(char)* game_board.width * game_board.height);
-                //char message[data_size];
+        // the game plays the version of the catalog it started on, even if the level directory changes meanwhile
+        catalog_t* catalog = catalog_acquire();
+        int total_levels = catalog->n_levels;
+        debug("Session of %s plays catalog version %lu\n", client_notification_pipe, catalog->version);
 
-                //board_to_message(message, &game_board, victory, game_over, accumulated_points);
+        tick_session_t tick_session;
+        session_threads_t session_threads;
+        tick_init(&tick_session, client_request_fd, client_notification_fd, &accumulated_points, thread_arg->ghost_pool);
+        session_threads_init(&session_threads, client_request_fd, client_notification_fd, &victory, &game_over, &accumulated_points);
 
-                //debug("WRITING IN: %d\n", client_notification_fd);
-                //write_full(client_notification_fd, message, data_size);
-
-                while(true) {
-                    pthread_t ncurses_tid, pacman_tid;
-                    pthread_t *ghost_tids = malloc(game_board.n_ghosts * sizeof(pthread_t));
-
-                    thread_shutdown = 0;
-
-                    debug("Creating threads\n");
+        pid_t parent_process = getpid(); // Only the parent process can create backups
 
-    
-                    pacman_thread_arg_t* pacman_arg = malloc(sizeof(pacman_thread_arg_t));
-                    pacman_arg->board = &game_board;
-                    pacman_arg->client_request_pipe = client_request_pipe;
-
-                    pthread_create(&pacman_tid, NULL, pacman_thread, pacman_arg);
-                    debug("Created pacman thread\n");
-                    for (int i = 0; i < game_board.n_ghosts; i++) {
-                        ghost_thread_arg_t *arg = malloc(sizeof(ghost_thread_arg_t));
-                        arg->board = &game_board;
-                        arg->ghost_index = i;
-                        pthread_create(&ghost_tids[i], NULL, ghost_thread, (void*) arg);
-                    }
-                    debug("Created ghost threads\n");
-                    
-                    game_board.session_active = true;
-
-                    ncurses_thread_arg_t *ncurses_arg = malloc(sizeof(ncurses_thread_arg_t));
-                    if (ncurses_arg == NULL) {
-                        perror("malloc ncurses_arg");
-                        thread_shutdown = 1;
-                        break;
-                    }
-                    ncurses_arg->board = &game_board;
-                    ncurses_arg->victory = &victory;
-                    ncurses_arg->game_over = &game_over;
-                    ncurses_arg->accumulated_points = &accumulated_points;
-                    ncurses_arg->client_notification_fd = client_notification_fd;
-                    pthread_create(&ncurses_tid, NULL, ncurses_thread, ncurses_arg);
+        // the levels come from the catalog in order, once the game ends the thread waits for another client
+        while (current_level < total_levels && !end_game) {
+            arena_mark_t level_mark = arena_mark(&arena);
+            if (load_level(&game_board, catalog_level(catalog, current_level), accumulated_points, &arena) < 0) {
+                arena_rewind(&arena, level_mark);
+                break;
+            }
+            seed_level(&game_board, session_seed, current_level);
+            affinity_bind_board(&game_board);
+            current_level++;
+        
+            //int data_size = sizeof(char) + (sizeof(int)*6) + (sizeof(char)* game_board.width * game_board.height);
+            //char message[data_size];
 
+            //board_to_message(message, &game_board, victory, game_over, accumulated_points);
 
-                    int *retval;
-                    pthread_join(pacman_tid, (void**)&retval); // ele não pode ficar à espera do pacman acabar, pois assim só dá refresh quando acaba/troca de nivel
-                    debug("Pacman thread joined\n");
+            //debug("WRITING IN: %d\n", client_notification_fd);
+            //write_full(client_notification_fd, message, data_size);
 
-                    pthread_rwlock_wrlock(&game_board.state_lock);
-                    thread_shutdown = 1;
-                    pthread_rwlock_unlock(&game_board.state_lock);
+            while(true) {
+                int result;
+                if (thread_arg->engine == ENGINE_TICK) {
+                    result = play_level_tick(&tick_session, &game_board);
+                } else {
+                    result = play_level_threads(&session_threads, &game_board);
+                }
 
-                    for (int i = 0; i < game_board.n_ghosts; i++) {
-                        pthread_join(ghost_tids[i], NULL);
+                if(result == NEXT_LEVEL) {
+                    screen_refresh(&game_board, DRAW_WIN);
+                    sleep_ms(game_board.tempo);
+                    if (current_level >= total_levels) {
+                        debug("All levels completed. Victory! current_level=%d total_levels=%d\n", current_level, total_levels);
+                        end_game = 1;
+                        debug("victory = 1\n");
+                        victory = 1;
                     }
+                    debug("returned-5\n");
+                    break;
+                }
 
-                    game_board.session_active = false;
-                    pthread_join(ncurses_tid, NULL);
-
-                    debug("Ghost threads joined\n");
-
-                    free(ghost_tids);
-                    free(pacman_arg);
-
-                    int result = *retval;
-                    free(retval);
-
-                    if(result == NEXT_LEVEL) {
-                        screen_refresh(&game_board, DRAW_WIN);
-                        sleep_ms(game_board.tempo);
-                        if (current_level >= total_levels) {
-                            debug("All levels completed. Victory! current_level=%d total_levels=%d\n", current_level, total_levels);
-                            end_game = 1;
-                            debug("victory = 1\n");
-                            victory = 1;
+                if(result == CREATE_BACKUP) {
+                    debug("CREATE_BACKUP\n");
+                    if (parent_process == getpid()) {
+                        debug("PARENT\n");
+                        pid_t child = create_backup();
+                        if (child == -1) {
+                            // failed to fork
+                            debug("[%d] Failed to create backup\n", getpid());
+                            end_game = true;
+                            debug("returned-4\n");
+                            break;
                         }
-                        debug("returned-5\n");
-                        break;
-                    }
-
-                    if(result == CREATE_BACKUP) {
-                        debug("CREATE_BACKUP\n");
-                        if (parent_process == getpid()) {
-                            debug("PARENT\n");
-                            pid_t child = create_backup();
-                            if (child == -1) {
-                                // failed to fork
-                                debug("[%d] Failed to create backup\n", getpid());
-                                end_game = true;
-                                debug("returned-4\n");
-                                break;
-                            }
-                            if (child > 0) {
-                                debug("Parent process\n");
-                                int status;
-                                wait(&status);
-
-                                if (WIFEXITED(status)) {
-                                    int code = WEXITSTATUS(status);
-                                    
-                                    if (code == 1) {
-                                        terminal_init();
-                                        debug("[%d] Save Resuming...\n", getpid());
-                                    }
-                                    else { // End game or error
-                                        end_game = true;
-                                        debug("returned-3\n");
-                                        break;
-                                    }
+                        if (child > 0) {
+                            debug("Parent process\n");
+                            int status;
+                            wait(&status);
+
+                            if (WIFEXITED(status)) {
+                                int code = WEXITSTATUS(status);
+                                
+                                if (code == 1) {
+                                    terminal_init();
+                                    debug("[%d] Save Resuming...\n", getpid());
+                                }
+                                else { // End game or error
+                                    end_game = true;
+                                    debug("returned-3\n");
+                                    break;
                                 }
-                            } else {
-                                terminal_init();
-                                debug("Child process\n");
                             }
-
                         } else {
-                            debug("[%d] Only parent process can have a save\n", getpid());
+                            terminal_init();
+                            session_threads_after_fork(&session_threads);
+                            tick_session.ghost_pool = NULL; // its threads stayed in the parent
+                            debug("Child process\n");
                         }
-                    }
 
-                    if(result == LOAD_BACKUP) {
-                        if(getpid() != parent_process) {
-                            terminal_cleanup();
-                            unload_level(&game_board);
-                            
-                            close_debug_file();
-
-                            if (closedir(level_dir) == -1) {
-                                fprintf(stderr, "Failed to close directory\n");
-                                debug("returned-2\n");
-                                return NULL;
-                            }
-                            debug("returned-1\n");
-                            return NULL;
-                        } else {
-                            // No backup process, game over
-                            result = QUIT_GAME;
-                        }
+                    } else {
+                        debug("[%d] Only parent process can have a save\n", getpid());
                     }
+                }
 
-                    if(result == QUIT_GAME) {
-                        screen_refresh(&game_board, DRAW_GAME_OVER); 
-                        sleep_ms(game_board.tempo);
-                        debug("game over = 1\n");
-                        game_over = 1;
-                        end_game = true;
-                        debug("QUIT_GAME\n");
-                        break;
+                if(result == LOAD_BACKUP) {
+                    if(getpid() != parent_process) {
+                        terminal_cleanup();
+                        session_threads_destroy(&session_threads);
+                        unload_level(&game_board);
+                        arena_destroy(&arena);
+                        catalog_release(catalog);
+                        
+                        close_debug_file();
+                        debug("returned-1\n");
+                        return NULL;
+                    } else {
+                        // No backup process, game over
+                        result = QUIT_GAME;
                     }
-                    
-                    accumulated_points = game_board.pacmans[0].points;
-                    debug("Accumulated points: %d\n", accumulated_points);
+                }
 
+                if(result == QUIT_GAME) {
+                    screen_refresh(&game_board, DRAW_GAME_OVER); 
+                    sleep_ms(game_board.tempo);
+                    debug("game over = 1\n");
+                    game_over = 1;
+                    end_game = true;
+                    debug("QUIT_GAME\n");
+                    break;
                 }
-                int data_size = sizeof(char) + (sizeof(int)*6) + (sizeof(char)* game_board.width * game_board.height);
-                char message[data_size];
+                
+                accumulated_points = game_board.pacmans[0].points;
+                debug("Accumulated points: %d\n", accumulated_points);
 
+            }
+            int data_size = board_message_size(&game_board);
+            char* message = arena_alloc(&arena, data_size);
+            if (message != NULL) {
                 board_to_message(message, &game_board, victory, game_over, accumulated_points);
 
                 debug("WRITING IN: %d\n", client_notification_fd);
                 write_full(client_notification_fd, message, data_size);
-                
-                unload_level(&game_board);
-                //por exemplo dar reset no readdir porque o jogo tem de reiniciar e esperar por outro cliente
             }
+
+            unload_level(&game_board);
+            arena_rewind(&arena, level_mark);
         }  
+        session_threads_destroy(&session_threads);
+        tick_destroy(&tick_session);
+        catalog_release(catalog);
         close(client_notification_fd);
-        closedir(level_dir); 
-        free(client_request_pipe);
-        free(client_notification_pipe);
+        close(client_request_fd);
+        debug("Session of %s used at most %zu bytes\n", client_notification_pipe, arena.peak);
+        shard_session_done();
     }
+    arena_destroy(&arena);
     return NULL;
     
 }
 
-int count_levels(DIR* level_dir) {
-    int count = 0;
-    struct dirent* entry;
-    while ((entry = readdir(level_dir)) != NULL) {
-        if (entry->d_name[0] == '.') continue;
-
-        char *dot = strrchr(entry->d_name, '.');
-        if (!dot) continue;
-        if (strcmp(dot, ".lvl") == 0) {
-            count++;
-        }
-    }
-    rewinddir(level_dir);
-    return count;
-}
-
 void queue_init(register_queue_t* register_queue, pthread_mutex_t* queue_mutex, sem_t* items, sem_t* empty) {
     register_queue->head = register_queue->tail = 0;
     pthread_mutex_init(queue_mutex, NULL);
@@ -610,29 +664,65 @@ void queue_destroy(pthread_mutex_t* mutex,sem_t* items, sem_t* empty) {
     sem_destroy(empty);
 }
 
-int main(int argc, char** argv) {
-    if ( argc < 4) {
-        fprintf(stderr,
-            "Usage: %s <levels_dir> <max_games> <nome_do_FIFO_de_registo>\n",
-            argv[0]);
-        return 1;
+typedef struct {
+    int engine;
+    int n_workers;
+    int n_ghost_threads;
+    int n_processes; // worker processes, 0 runs every session in this one
+    int max_games;
+    char* register_pipe_name;
+    int accept_cpu;
+    char* handoff_path; // socket sessions are handed over on when the server is replaced, NULL for none
+} server_config_t;
+
+// Helper private function, creates the register FIFO clients connect through, keeping the one of the server this one replaced
+static int create_register_fifo(char* register_pipe_name, bool keep) {
+    if (!keep) {
+        debug("unlink fifo: %s\n", register_pipe_name);
+        unlink(register_pipe_name); // Unlink existing pipe
+    }
+    debug("Creating register fifo: %s\n", register_pipe_name);
+    // clients that kept writing through the hand off are waiting on the old one
+    if(mkfifo(register_pipe_name, 0666) == -1 && !(keep && errno == EEXIST)){
+        perror("mkfifo");
+        return -1;
     }
+    return 0;
+}
 
-    // Random seed for any random movements
-    srand((unsigned int)time(NULL));
-    open_debug_file("debug_server.log");
+// Helper private function, waits for the next connect record, from the master when dispatch_fd is set or else from the register FIFO
+// returns 1 for a valid record, 0 for one to skip and -1 once no more will come
+static int read_connect(char* register_pipe_name, int dispatch_fd, char* record) {
+    if (dispatch_fd >= 0) {
+        // the master already checked it
+        return read_full(dispatch_fd, record, CONNECT_RECORD_SIZE) < 0 ? -1 : 1;
+    }
 
-    debug("opening level dir: %s\n", argv[1]);
-    DIR* level_dir = opendir(argv[1]);
-    if (level_dir == NULL) {
-        perror("opendir");
+    int register_pipe_fd = open(register_pipe_name, O_RDONLY);
+    if(register_pipe_fd < 0){
+        perror("open register fifo");
         return -1;
     }
-    int total_levels = count_levels(level_dir);
+    ssize_t n = read_full(register_pipe_fd, record, CONNECT_RECORD_SIZE);
+    close(register_pipe_fd);
+    if (n <= 0) {
+        debug("No data read from register fifo, continuing...\n");
+        return 0;
+    }
+    debug("read from register fifo: %.*s\n", CONNECT_RECORD_SIZE, record);
 
-    closedir(level_dir);
+    char op_code = record[0];
+    if(op_code != (char)('0' + OP_CODE_CONNECT)){
+        debug("Op code inválido: %c (esperado: %c)\n",op_code, (char)('0' + OP_CODE_CONNECT));
+        return 0;
+    }
+    return 1;
+}
 
-    int max_games = atoi(argv[2]);
+// Helper private function, runs a session pool on the connect records of the register FIFO, or of the master in a worker
+static int run_sessions(server_config_t* config, int dispatch_fd) {
+    int engine = config->engine;
+    int max_games = config->max_games;
 
     register_queue_t* client_queue = malloc(sizeof(register_queue_t));
     pthread_mutex_t queue_mutex;
@@ -640,97 +730,239 @@ int main(int argc, char** argv) {
 
     queue_init(client_queue, &queue_mutex, &items, &empty);
 
+    // every process running sessions watches the level directory, a worker respawned from the master catches up first
+    if (catalog_watch() < 0) debug("Level directory not watched, changes need a restart: %s\n", strerror(errno));
+
+    // the thread engine already has one thread per ghost
+    ghost_pool_t* ghost_pool = NULL;
+    if (engine != ENGINE_THREADS && config->n_ghost_threads > 1) {
+        ghost_pool = ghost_pool_create(config->n_ghost_threads);
+    }
+
+    // the reactor runs every session on its own workers
+    reactor_t* reactor = NULL;
+    int n_session_threads = max_games;
+    if (engine == ENGINE_REACTOR) {
+        reactor = reactor_create(config->n_workers, max_games, ghost_pool);
+        n_session_threads = 0;
+    }
+
+    bool shutdown = false;
     pthread_t* sessions = malloc(sizeof(pthread_t) * max_games);
     session_thread_arg_t* sessions_args = malloc(sizeof(session_thread_arg_t) * max_games);
 
 
-    for (int id_thread = 0; id_thread < max_games; id_thread++) {
-        sessions_args[id_thread].level_dir_name = argv[1];
-        sessions_args[id_thread].total_levels = total_levels;
+    for (int id_thread = 0; id_thread < n_session_threads; id_thread++) {
         sessions_args[id_thread].client_queue = client_queue;
         sessions_args[id_thread].queue_mutex = &queue_mutex;
         sessions_args[id_thread].items = &items;
         sessions_args[id_thread].empty = &empty;
-        sessions_args[id_thread].shutdown = false;
+        sessions_args[id_thread].shutdown = &shutdown;
+        sessions_args[id_thread].engine = engine;
+        sessions_args[id_thread].ghost_pool = ghost_pool;
+        sessions_args[id_thread].cpu = affinity_cpu(id_thread);
 
         debug("BEFORE Creating session manager thread\n");
         pthread_create(&sessions[id_thread], NULL, individual_session_thread, &sessions_args[id_thread]); 
     }
 
-    char* register_pipe_name = argv[3];
+    char* register_pipe_name = config->register_pipe_name;
 
-    debug("unlink fifo: %s\n", register_pipe_name);
-    unlink(register_pipe_name); // Unlink existing pipe
-    debug("Creating register fifo: %s\n", register_pipe_name);
-    if(mkfifo(register_pipe_name, 0666) == -1){
-        perror("mkfifo");
-        return 1;  
+    // the reactor can take the sessions of a running server and later give them to the next one
+    handoff_t* handoff = NULL;
+    bool taken_over = false;
+    if (reactor != NULL && config->handoff_path != NULL) {
+        int previous = handoff_connect(config->handoff_path);
+        if (previous == HANDOFF_REFUSED) {
+            fprintf(stderr, "The server running on %s is of another version\n", config->handoff_path);
+            return 1;
+        }
+        if (previous >= 0) {
+            debug("Took over %d sessions\n", reactor_take_over(reactor, previous));
+            close(previous);
+            taken_over = true;
+        }
+        handoff = handoff_listen(config->handoff_path, register_pipe_name);
     }
 
+    if (dispatch_fd < 0) {
+        if (create_register_fifo(register_pipe_name, taken_over) < 0) return 1;
 
-    int register_pipe_fd = -1;
+        // only now, so the threads created above do not inherit the core
+        affinity_pin(config->accept_cpu);
+    }
 
-    while(1){    
-        register_pipe_fd = open(register_pipe_name, O_RDONLY);
-        if(register_pipe_fd < 0){
-            perror("open register fifo");
-            break;//algo me diz que não suposto darmos return aqui (falta libertar memória etc)
-        }
-        char buffer[81];
-        ssize_t n = read_full(register_pipe_fd, buffer, 81);
-        debug("read from register fifo: %s\n", buffer); 
-        if (n <= 0) {
-            debug("No data read from register fifo, continuing...\n");
-            close(register_pipe_fd);
-            continue;
-        } 
-        char op_code = buffer[0];
-        if(op_code != (char)('0' + OP_CODE_CONNECT)){
-            debug("Op code inválido: %c (esperado: %c)\n",op_code, (char)('0' + OP_CODE_CONNECT));
-            close(register_pipe_fd);
-            continue;
-        }
+    char record[CONNECT_RECORD_SIZE];
+    int status;
+    while(handoff_socket(handoff) < 0 && (status = read_connect(register_pipe_name, dispatch_fd, record)) >= 0){
+        if (status == 0) continue;
 
-        char client_request_pipe[41];
-        char client_notification_pipe[41];
+        char client_request_pipe[MAX_PIPE_PATH_LENGTH + 1];
+        char client_notification_pipe[MAX_PIPE_PATH_LENGTH + 1];
 
-        memcpy(client_request_pipe, buffer + 1, 40);
-        client_request_pipe[40] = '\0';
+        memcpy(client_request_pipe, record + 1, MAX_PIPE_PATH_LENGTH);
+        client_request_pipe[MAX_PIPE_PATH_LENGTH] = '\0';
 
-        memcpy(client_notification_pipe, buffer + 41, 40);
-        client_notification_pipe[40] = '\0';
+        memcpy(client_notification_pipe, record + 1 + MAX_PIPE_PATH_LENGTH, MAX_PIPE_PATH_LENGTH);
+        client_notification_pipe[MAX_PIPE_PATH_LENGTH] = '\0';
 
-        debug("Enqueuing client pipes: req=%s, notif=%s\n", client_request_pipe, client_notification_pipe);
-        enqueue(client_queue, &queue_mutex, &items, &empty, client_request_pipe, client_notification_pipe);
-        close(register_pipe_fd);
+        if (reactor != NULL) {
+            reactor_add_client(reactor, client_request_pipe, client_notification_pipe);
+        } else {
+            debug("Enqueuing client pipes: req=%s, notif=%s\n", client_request_pipe, client_notification_pipe);
+            enqueue(client_queue, &queue_mutex, &items, &empty, client_request_pipe, client_notification_pipe);
+        }
     }
+    int next_server = handoff_socket(handoff);
+    handoff_close(handoff);
     debug("Shutting down server...\n");
-    for (int i = 0; i < max_games; i++) {
-        sessions_args[i].shutdown = true;
-    }
+    shutdown = true;
     
     // Desbloqueia threads que estão em dequeue
-    for (int i = 0; i < max_games; i++) {
+    for (int i = 0; i < n_session_threads; i++) {
         sem_post(&items);  // Falso sinal para desbloquear
     }
     
-    for (int i = 0; i < max_games; i++) {
+    for (int i = 0; i < n_session_threads; i++) {
         pthread_join(sessions[i], NULL);
     }
 
+    if (reactor != NULL && next_server >= 0) {
+        reactor_hand_off(reactor, next_server);
+        close(next_server);
+    } else if (reactor != NULL) {
+        reactor_destroy(reactor);
+    }
+    if (ghost_pool != NULL) {
+        ghost_pool_destroy(ghost_pool);
+    }
+
     free(sessions);
     free(sessions_args);
     queue_destroy(&queue_mutex, &items, &empty);
     free(client_queue); 
 
+    if (dispatch_fd >= 0) {
+        close(dispatch_fd);
+    } else if (next_server < 0) {
+        unlink(register_pipe_name); // after a hand off the next server reads it
+    }
+    return 0;
+}
+
+// Helper private function, body of every worker process, which gets its share of the sessions and cores
+static int run_worker(int index, int dispatch_fd, void* arg) {
+    server_config_t config = *(server_config_t*) arg;
+    int n = config.n_processes;
+    config.max_games = (config.max_games + n - 1) / n;
+    config.n_workers = config.n_workers > n ? config.n_workers / n : 1;
+    config.n_ghost_threads = config.n_ghost_threads > n ? config.n_ghost_threads / n : 1;
+    affinity_restrict(index, n);
+    rng_set_process(index);
+
+    // sessions of other workers must not wait on the lock of this file
+    char debug_file_name[MAX_FILENAME];
+    snprintf(debug_file_name, sizeof(debug_file_name), "debug_server_%d.log", index);
     close_debug_file();
+    open_debug_file(debug_file_name);
+
+    int result = run_sessions(&config, dispatch_fd);
+    close_debug_file();
+    return result;
+}
+
+// Helper private function, master of the multi-process mode, only reads the register FIFO and dispatches
+static int run_master(server_config_t* config) {
+    shards_t* shards = shards_create(config->n_processes, run_worker, config);
+    if (shards == NULL) return 1;
 
-    if (register_pipe_fd >= 0) {
-        close(register_pipe_fd);
+    char* register_pipe_name = config->register_pipe_name;
+    if (create_register_fifo(register_pipe_name, false) < 0) {
+        shards_destroy(shards);
+        return 1;
     }
+    affinity_pin(config->accept_cpu);
 
+    char record[CONNECT_RECORD_SIZE];
+    int status;
+    while((status = read_connect(register_pipe_name, -1, record)) >= 0){
+        if (status == 0) continue;
 
-    unlink(register_pipe_name);
+        int worker = shards_dispatch(shards, record);
+        if (worker < 0) {
+            debug("No worker left for %.*s\n", MAX_PIPE_PATH_LENGTH, record + 1 + MAX_PIPE_PATH_LENGTH);
+            continue;
+        }
+        debug("Client %.*s handed to worker %d\n", MAX_PIPE_PATH_LENGTH, record + 1 + MAX_PIPE_PATH_LENGTH, worker);
+    }
+    debug("Shutting down server...\n");
 
+    shards_destroy(shards);
+    unlink(register_pipe_name);
     return 0;
 }
+
+int main(int argc, char** argv) {
+    char* program = argv[0];
+    server_config_t config;
+    config.engine = ENGINE_THREADS;
+    config.n_workers = (int) sysconf(_SC_NPROCESSORS_ONLN); // one reactor worker per core
+    config.n_ghost_threads = config.n_workers; // big boards move their ghosts on every core
+    config.n_processes = 0;
+    config.accept_cpu = -1;
+    config.handoff_path = NULL;
+    int opt;
+    while ((opt = getopt(argc, argv, "e:w:g:s:a:c:p:u:")) != -1) {
+        if (opt == 'e' && strcmp(optarg, "threads") == 0) config.engine = ENGINE_THREADS;
+        else if (opt == 'e' && strcmp(optarg, "tick") == 0) config.engine = ENGINE_TICK;
+        else if (opt == 'e' && strcmp(optarg, "reactor") == 0) config.engine = ENGINE_REACTOR;
+        else if (opt == 'w' && atoi(optarg) > 0) config.n_workers = atoi(optarg);
+        else if (opt == 'g' && atoi(optarg) > 0) config.n_ghost_threads = atoi(optarg);
+        else if (opt == 's') rng_set_base_seed(strtoull(optarg, NULL, 10));
+        else if (opt == 'a' && atoi(optarg) >= 0) config.accept_cpu = atoi(optarg);
+        else if (opt == 'c' && affinity_set_cpus(optarg) == 0) continue;
+        else if (opt == 'p' && atoi(optarg) >= 0) config.n_processes = atoi(optarg);
+        else if (opt == 'u') config.handoff_path = optarg;
+        else {
+            optind = argc; // force the usage message
+            break;
+        }
+    }
+    argv += optind - 1; // positional arguments start at argv[1]
+    argc -= optind - 1;
+
+    // only the reactor keeps its sessions as state that can be handed over
+    bool handoff_unsupported = config.handoff_path != NULL && (config.engine != ENGINE_REACTOR || config.n_processes > 0);
+    if ( argc < 4 || handoff_unsupported) {
+        fprintf(stderr,
+            "Usage: %s [-e threads|tick|reactor] [-w workers] [-g ghost_threads] [-s seed] [-a accept_cpu] [-c session_cpus] [-p processes] [-u handoff_socket] <levels_dir> <max_games> <nome_do_FIFO_de_registo>\n",
+            program);
+        return 1;
+    }
+
+    open_debug_file("debug_server.log");
+
+    // A client leaving must not take the whole server down with it
+    signal(SIGPIPE, SIG_IGN);
+
+    debug("opening level dir: %s\n", argv[1]);
+    // parsed before any session starts, worker processes inherit it
+    if (catalog_open(argv[1]) < 0) {
+        perror("opendir");
+        return -1;
+    }
+
+    config.max_games = atoi(argv[2]);
+    config.register_pipe_name = argv[3];
+
+    int result;
+    if (config.n_processes > 0) {
+        result = run_master(&config);
+    } else {
+        result = run_sessions(&config, -1);
+    }
+
+    catalog_close();
+    close_debug_file();
+    return result;
+}
@@ -0,0 +1,227 @@
+#include "ghost_pool.h"
+#include "affinity.h"
+#include <stdlib.h>
+#include <limits.h>
+
+struct ghost_round {
+    board_t* board;
+    unsigned long tick;
+    int* targets; // cell proposed by each ghost, -1 if it stays
+    int targets_capacity;
+    atomic_int* claims; // lowest index of the ghosts proposing each cell, INT_MAX if none
+    int claims_capacity;
+    atomic_bool pacman_caught;
+};
+
+typedef void (*phase_t)(ghost_round_t* round, int first, int last);
+
+struct ghost_pool {
+    pthread_mutex_t update_lock; // one board at a time, the others move alone meanwhile
+    pthread_mutex_t lock; // guards the fields up to n_items
+    pthread_cond_t start;
+    pthread_cond_t done;
+    unsigned long generation; // bumped for every phase
+    int busy; // helpers still taking chunks of the current phase
+    bool shutdown;
+    phase_t phase;
+    int n_items;
+    atomic_int next_chunk;
+    ghost_round_t* round; // board being moved, set under update_lock
+    int n_helpers;
+    atomic_int n_started; // helpers take the cores of the set in turn
+    pthread_t* helpers;
+};
+
+// Helper private function, takes chunks of a phase until there are none left
+static void run_chunks(ghost_pool_t* pool, phase_t phase, int n_items) {
+    while (true) {
+        int first = atomic_fetch_add(&pool->next_chunk, 1) * GHOST_POOL_CHUNK;
+        if (first >= n_items) return;
+
+        int last = first + GHOST_POOL_CHUNK;
+        if (last > n_items) last = n_items;
+        phase(pool->round, first, last);
+    }
+}
+
+static void* helper_thread(void* arg) {
+    ghost_pool_t* pool = (ghost_pool_t*) arg;
+    unsigned long seen = 0;
+
+    affinity_pin(affinity_cpu(atomic_fetch_add(&pool->n_started, 1)));
+
+    pthread_mutex_lock(&pool->lock);
+    while (true) {
+        while (!pool->shutdown && pool->generation == seen) {
+            pthread_cond_wait(&pool->start, &pool->lock);
+        }
+        if (pool->shutdown) break;
+
+        seen = pool->generation;
+        phase_t phase = pool->phase;
+        int n_items = pool->n_items;
+        pool->busy++;
+        pthread_mutex_unlock(&pool->lock);
+
+        run_chunks(pool, phase, n_items);
+
+        pthread_mutex_lock(&pool->lock);
+        if (--pool->busy == 0) pthread_cond_signal(&pool->done);
+    }
+    pthread_mutex_unlock(&pool->lock);
+    return NULL;
+}
+
+// Helper private function, runs one phase over every thread of the pool and the caller
+static void run_phase(ghost_pool_t* pool, phase_t phase, int n_items) {
+    pthread_mutex_lock(&pool->lock);
+    // a helper that woke up late may still be holding on to the previous phase
+    while (pool->busy > 0) {
+        pthread_cond_wait(&pool->done, &pool->lock);
+    }
+    pool->phase = phase;
+    pool->n_items = n_items;
+    atomic_store(&pool->next_chunk, 0);
+    pool->generation++;
+    pthread_cond_broadcast(&pool->start);
+    pthread_mutex_unlock(&pool->lock);
+
+    run_chunks(pool, phase, n_items);
+
+    pthread_mutex_lock(&pool->lock);
+    while (pool->busy > 0) {
+        pthread_cond_wait(&pool->done, &pool->lock);
+    }
+    pthread_mutex_unlock(&pool->lock);
+}
+
+// Phase one, every ghost due this tick proposes a cell and bids for it with its index
+static void propose_phase(ghost_round_t* round, int first, int last) {
+    board_t* board = round->board;
+
+    for (int i = first; i < last; i++) {
+        ghost_t* ghost = &board->ghosts[i];
+        round->targets[i] = -1;
+        if (ghost->n_moves == 0) continue;
+        if (round->tick % (1 + ghost->passo) != 0) continue;
+
+        int target = propose_ghost_move(board, i, ghost_command(board, i));
+        round->targets[i] = target;
+        if (target < 0) continue;
+
+        int claim = atomic_load(&round->claims[target]);
+        while (i < claim && !atomic_compare_exchange_weak(&round->claims[target], &claim, i));
+    }
+}
+
+// Phase two, the lowest index bidding for a cell moves into it, the others stay put
+static void commit_phase(ghost_round_t* round, int first, int last) {
+    board_t* board = round->board;
+
+    for (int i = first; i < last; i++) {
+        int target = round->targets[i];
+        if (target < 0 || atomic_load(&round->claims[target]) != i) continue;
+
+        if (commit_ghost_move(board, i, target) == DEAD_PACMAN) {
+            atomic_store(&round->pacman_caught, true);
+        }
+        // losers read INT_MAX from now on, which is not their index either
+        atomic_store(&round->claims[target], INT_MAX);
+    }
+}
+
+ghost_pool_t* ghost_pool_create(int n_threads) {
+    ghost_pool_t* pool = calloc(1, sizeof(ghost_pool_t));
+    pthread_mutex_init(&pool->update_lock, NULL);
+    pthread_mutex_init(&pool->lock, NULL);
+    pthread_cond_init(&pool->start, NULL);
+    pthread_cond_init(&pool->done, NULL);
+    atomic_init(&pool->next_chunk, 0);
+    atomic_init(&pool->n_started, 0);
+
+    pool->n_helpers = n_threads > 1 ? n_threads - 1 : 0;
+    pool->helpers = malloc(pool->n_helpers * sizeof(pthread_t));
+    for (int i = 0; i < pool->n_helpers; i++) {
+        pthread_create(&pool->helpers[i], NULL, helper_thread, pool);
+    }
+
+    debug("Ghost pool started with %d threads\n", pool->n_helpers + 1);
+    return pool;
+}
+
+void ghost_pool_destroy(ghost_pool_t* pool) {
+    pthread_mutex_lock(&pool->lock);
+    pool->shutdown = true;
+    pthread_cond_broadcast(&pool->start);
+    pthread_mutex_unlock(&pool->lock);
+
+    for (int i = 0; i < pool->n_helpers; i++) {
+        pthread_join(pool->helpers[i], NULL);
+    }
+
+    pthread_cond_destroy(&pool->start);
+    pthread_cond_destroy(&pool->done);
+    pthread_mutex_destroy(&pool->lock);
+    pthread_mutex_destroy(&pool->update_lock);
+    free(pool->helpers);
+    free(pool);
+}
+
+void ghost_round_free(ghost_round_t* round) {
+    if (round == NULL) return;
+    free(round->targets);
+    free(round->claims);
+    free(round);
+}
+
+// Helper private function, makes room for the proposals and bids of a board
+static int reserve(ghost_round_t* round, board_t* board) {
+    if (board->n_ghosts > round->targets_capacity) {
+        int* targets = realloc(round->targets, board->n_ghosts * sizeof(int));
+        if (targets == NULL) return -1;
+        round->targets = targets;
+        round->targets_capacity = board->n_ghosts;
+    }
+
+    int n_cells = board->width * board->height;
+    if (n_cells > round->claims_capacity) {
+        atomic_int* claims = realloc(round->claims, n_cells * sizeof(atomic_int));
+        if (claims == NULL) return -1;
+        for (int i = round->claims_capacity; i < n_cells; i++) {
+            atomic_init(&claims[i], INT_MAX);
+        }
+        round->claims = claims;
+        round->claims_capacity = n_cells;
+    }
+    return 0;
+}
+
+int ghost_pool_update(ghost_pool_t* pool, ghost_round_t** round_ptr, board_t* board, unsigned long tick) {
+    if (*round_ptr == NULL) {
+        *round_ptr = calloc(1, sizeof(ghost_round_t));
+        if (*round_ptr == NULL) return INVALID_MOVE;
+        atomic_init(&(*round_ptr)->pacman_caught, false);
+    }
+    ghost_round_t* round = *round_ptr;
+    if (reserve(round, board) < 0) {
+        debug("Not enough memory to move %d ghosts\n", board->n_ghosts);
+        return INVALID_MOVE;
+    }
+
+    round->board = board;
+    round->tick = tick;
+    atomic_store(&round->pacman_caught, false);
+
+    if (pthread_mutex_trylock(&pool->update_lock) == 0) {
+        pool->round = round;
+        run_phase(pool, propose_phase, board->n_ghosts);
+        run_phase(pool, commit_phase, board->n_ghosts);
+        pthread_mutex_unlock(&pool->update_lock);
+    } else {
+        // same phases over the whole board, so the outcome is the one the pool would give
+        propose_phase(round, 0, board->n_ghosts);
+        commit_phase(round, 0, board->n_ghosts);
+    }
+
+    return atomic_load(&round->pacman_caught) ? DEAD_PACMAN : VALID_MOVE;
+}
@@ -0,0 +1,186 @@
+#include "handoff.h"
+#include "board.h"
+#include "protocol.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+struct handoff {
+    int listen_fd;
+    atomic_int sock; // server taking over, -1 until it connects
+    atomic_bool closed; // the accept loop is over, nobody left to poke
+    const char* register_pipe_name;
+    pthread_t tid;
+};
+
+// Helper private function, fills the address of the socket on path
+static int socket_address(const char* path, struct sockaddr_un* address) {
+    memset(address, 0, sizeof(*address));
+    address->sun_family = AF_UNIX;
+    if (strlen(path) >= sizeof(address->sun_path)) {
+        debug("Handoff socket path too long: %s\n", path);
+        return -1;
+    }
+    strcpy(address->sun_path, path);
+    return 0;
+}
+
+static void* handoff_thread(void* arg) {
+    handoff_t* handoff = (handoff_t*) arg;
+
+    int sock;
+    while (true) {
+        sock = accept(handoff->listen_fd, NULL, NULL);
+        if (sock < 0) return NULL; // closed before anyone took over
+
+        int version;
+        if (read_full(sock, &version, sizeof(version)) == sizeof(version) && version == HANDOFF_VERSION) break;
+        debug("Refusing to hand the sessions to a server of another version\n");
+        close(sock);
+    }
+    int version = HANDOFF_VERSION;
+    if (write_full(sock, &version, sizeof(version)) < 0) {
+        close(sock);
+        return NULL;
+    }
+
+    debug("A new server is taking over\n");
+    atomic_store(&handoff->sock, sock);
+
+    // the accept loop sits in open() until a writer shows up, this one carries no record
+    while (!atomic_load(&handoff->closed)) {
+        int fd = open(handoff->register_pipe_name, O_WRONLY | O_NONBLOCK);
+        if (fd >= 0) {
+            close(fd);
+            break;
+        }
+        sleep_ms(HANDOFF_POKE_MS); // between two clients, nobody is reading
+    }
+    return NULL;
+}
+
+handoff_t* handoff_listen(const char* path, const char* register_pipe_name) {
+    struct sockaddr_un address;
+    if (socket_address(path, &address) < 0) return NULL;
+
+    int listen_fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (listen_fd < 0) {
+        perror("socket");
+        return NULL;
+    }
+    unlink(path); // left behind by the server this one replaced
+    if (bind(listen_fd, (struct sockaddr*) &address, sizeof(address)) < 0 || listen(listen_fd, 1) < 0) {
+        perror("bind handoff socket");
+        close(listen_fd);
+        return NULL;
+    }
+
+    handoff_t* handoff = malloc(sizeof(handoff_t));
+    handoff->listen_fd = listen_fd;
+    atomic_init(&handoff->sock, -1);
+    atomic_init(&handoff->closed, false);
+    handoff->register_pipe_name = register_pipe_name;
+    pthread_create(&handoff->tid, NULL, handoff_thread, handoff);
+
+    debug("Listening for the next server on %s\n", path);
+    return handoff;
+}
+
+int handoff_socket(handoff_t* handoff) {
+    if (handoff == NULL) return -1;
+    return atomic_load(&handoff->sock);
+}
+
+void handoff_close(handoff_t* handoff) {
+    if (handoff == NULL) return;
+
+    atomic_store(&handoff->closed, true);
+    // gets the thread out of accept
+    shutdown(handoff->listen_fd, SHUT_RDWR);
+    pthread_join(handoff->tid, NULL);
+    close(handoff->listen_fd);
+    free(handoff);
+}
+
+int handoff_connect(const char* path) {
+    struct sockaddr_un address;
+    if (socket_address(path, &address) < 0) return -1;
+
+    int sock = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (sock < 0) {
+        perror("socket");
+        return -1;
+    }
+    if (connect(sock, (struct sockaddr*) &address, sizeof(address)) < 0) {
+        close(sock); // no server running yet
+        return -1;
+    }
+
+    int version = HANDOFF_VERSION;
+    if (write_full(sock, &version, sizeof(version)) < 0 || read_full(sock, &version, sizeof(version)) < 0 ||
+        version != HANDOFF_VERSION) {
+        close(sock);
+        return HANDOFF_REFUSED;
+    }
+    return sock;
+}
+
+int handoff_send(int sock, const void* data, size_t size, const int* fds, int n_fds) {
+    char control[CMSG_SPACE(HANDOFF_MAX_FDS * sizeof(int))];
+    struct iovec iov = {(void*) data, size};
+    struct msghdr message;
+    memset(&message, 0, sizeof(message));
+    message.msg_iov = &iov;
+    message.msg_iovlen = 1;
+
+    if (n_fds > 0) {
+        memset(control, 0, sizeof(control));
+        message.msg_control = control;
+        message.msg_controllen = CMSG_SPACE(n_fds * sizeof(int));
+        struct cmsghdr* header = CMSG_FIRSTHDR(&message);
+        header->cmsg_level = SOL_SOCKET;
+        header->cmsg_type = SCM_RIGHTS;
+        header->cmsg_len = CMSG_LEN(n_fds * sizeof(int));
+        memcpy(CMSG_DATA(header), fds, n_fds * sizeof(int));
+    }
+
+    ssize_t sent = sendmsg(sock, &message, 0);
+    if (sent < 0) return -1;
+    // the descriptors went with the first byte, the rest is plain data
+    if ((size_t) sent < size && write_full(sock, (const char*) data + sent, size - sent) < 0) return -1;
+    return 0;
+}
+
+int handoff_recv(int sock, void* data, size_t size, int* fds, int* n_fds) {
+    char control[CMSG_SPACE(HANDOFF_MAX_FDS * sizeof(int))];
+    struct iovec iov = {data, size};
+    struct msghdr message;
+    memset(&message, 0, sizeof(message));
+    message.msg_iov = &iov;
+    message.msg_iovlen = 1;
+    message.msg_control = control;
+    message.msg_controllen = sizeof(control);
+
+    ssize_t received;
+    do {
+        received = recvmsg(sock, &message, MSG_WAITALL);
+    } while (received < 0 && errno == EINTR);
+    if (received <= 0) return -1;
+
+    *n_fds = 0;
+    for (struct cmsghdr* header = CMSG_FIRSTHDR(&message); header != NULL; header = CMSG_NXTHDR(&message, header)) {
+        if (header->cmsg_level != SOL_SOCKET || header->cmsg_type != SCM_RIGHTS) continue;
+        *n_fds = (header->cmsg_len - CMSG_LEN(0)) / sizeof(int);
+        memcpy(fds, CMSG_DATA(header), *n_fds * sizeof(int));
+    }
+
+    if ((size_t) received < size && read_full(sock, (char*) data + received, size - received) < 0) return -1;
+    return 0;
+}
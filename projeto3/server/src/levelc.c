@@ -0,0 +1,70 @@
+#include "board.h"
+#include "levelfile.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <dirent.h>
+
+/*
+Compiles the levels of a directory into the binary form the server maps
+instead of parsing: level1.lvl, with the pacman and ghost files it names,
+becomes level1.lvb next to it. Editing the .lvl afterwards makes the server
+go back to the text until the level is compiled again.
+Usage: levelc <levels_dir>
+*/
+
+// Helper private function, compiles one level file of dirname, -1 on error
+static int compile_level(char* dirname, char* filename) {
+    level_t* level = level_parse(filename, dirname);
+    if (level == NULL) return -1;
+
+    // level1.lvl -> dirname/level1.lvb
+    char* path = malloc(strlen(dirname) + strlen(filename) + strlen(LEVEL_FILE_EXTENSION) + 2);
+    if (path == NULL) {
+        level_release(level);
+        return -1;
+    }
+    sprintf(path, "%s/%s", dirname, filename);
+    strcpy(strrchr(path, '.'), LEVEL_FILE_EXTENSION);
+
+    int result = level_write(level, path);
+    if (result < 0) perror(path);
+    else printf("%s/%s -> %s\n", dirname, filename, path);
+
+    free(path);
+    level_release(level);
+    return result;
+}
+
+int main(int argc, char** argv) {
+    if (argc != 2) {
+        fprintf(stderr, "Usage: %s <levels_dir>\n", argv[0]);
+        return 1;
+    }
+
+    DIR* level_dir = opendir(argv[1]);
+    if (level_dir == NULL) {
+        perror("opendir");
+        return 1;
+    }
+
+    // the parser logs every file it reads
+    open_debug_file("/dev/null");
+
+    int failed = 0;
+    struct dirent* entry;
+    while ((entry = readdir(level_dir)) != NULL) {
+        if (entry->d_name[0] == '.') continue;
+        char *dot = strrchr(entry->d_name, '.');
+        if (!dot || strcmp(dot, ".lvl") != 0) continue;
+
+        if (compile_level(argv[1], entry->d_name) < 0) {
+            fprintf(stderr, "Failed to compile %s/%s\n", argv[1], entry->d_name);
+            failed++;
+        }
+    }
+    closedir(level_dir);
+
+    close_debug_file();
+    return failed > 0 ? 1 : 0;
+}
@@ -0,0 +1,308 @@
+#include "levelfile.h"
+#include "protocol.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+// Helper private function, sizes of the structs a level file stores, one per byte
+static uint32_t level_file_layout() {
+    return sizeof(pacman_t) | sizeof(ghost_t) << 8 | sizeof(script_t) << 16 | sizeof(command_t) << 24;
+}
+
+// Helper private function, offset rounded up to the start of the next section
+static uint64_t align_section(uint64_t offset) {
+    return (offset + LEVEL_FILE_ALIGN - 1) & ~(uint64_t) (LEVEL_FILE_ALIGN - 1);
+}
+
+// Helper private function, bytes of a section of the file
+static size_t section_size(const level_file_t* file, int section) {
+    size_t n_cells = (size_t) file->width * file->height;
+    size_t layer_words = (size_t) file->height * file->row_words + (size_t) file->width * file->column_words;
+
+    switch (section) {
+        case SECTION_STATIC_LAYERS: return N_STATIC_LAYERS * layer_words * sizeof(atomic_ullong);
+        case SECTION_PASSABLE: return n_cells;
+        case SECTION_CELLS: return n_cells * sizeof(board_pos_t);
+        case SECTION_LAYERS: return (N_LAYERS - N_STATIC_LAYERS) * layer_words * sizeof(atomic_ullong);
+        case SECTION_OCCUPANTS: return n_cells * sizeof(atomic_int);
+        case SECTION_PACMANS: return file->n_pacmans * sizeof(pacman_t);
+        case SECTION_GHOSTS: return file->n_ghosts * sizeof(ghost_t);
+        case SECTION_PACMAN_SCRIPTS: return file->n_pacmans * sizeof(script_t);
+        case SECTION_GHOST_SCRIPTS: return file->n_ghosts * sizeof(script_t);
+        case SECTION_COMMANDS: return file->n_commands * sizeof(command_t);
+        default: return file->sources_size;
+    }
+}
+
+// Helper private function, SECTION_SOURCES of a parsed level in a new buffer of *size bytes
+static char* level_sources(level_t* level, uint32_t* size) {
+    // the scripts sit next to the level file, the directory is left out
+    size_t prefix = strrchr(level->path, '/') != NULL ? strrchr(level->path, '/') - level->path + 1 : 0;
+    int n_ghosts = level->start->n_ghosts;
+
+    size_t total = (level->pacman_file != NULL ? strlen(level->pacman_file + prefix) : 0) + 1;
+    for (int i = 0; i < n_ghosts; i++) {
+        total += strlen(level->ghosts_files[i] + prefix) + 1;
+    }
+
+    char* sources = malloc(total);
+    if (sources == NULL) return NULL;
+    char* next = stpcpy(sources, level->pacman_file != NULL ? level->pacman_file + prefix : "") + 1;
+    for (int i = 0; i < n_ghosts; i++) {
+        next = stpcpy(next, level->ghosts_files[i] + prefix) + 1;
+    }
+    *size = total;
+    return sources;
+}
+
+// Helper private function, the array of a parsed level a section holds, SECTION_SOURCES excepted
+static const void* section_data(level_t* level, int section) {
+    board_t* start = level->start;
+
+    switch (section) {
+        case SECTION_STATIC_LAYERS: return level->layers;
+        case SECTION_PASSABLE: return level->passable;
+        case SECTION_CELLS: return start->board;
+        case SECTION_LAYERS: return start->layers;
+        case SECTION_OCCUPANTS: return start->occupants;
+        case SECTION_PACMANS: return start->pacmans;
+        case SECTION_GHOSTS: return start->ghosts;
+        case SECTION_PACMAN_SCRIPTS: return start->pacman_scripts;
+        case SECTION_GHOST_SCRIPTS: return start->ghost_scripts;
+        default: return start->commands;
+    }
+}
+
+int level_write(level_t* level, char* path) {
+    board_t* start = level->start;
+    level_file_t file;
+    memset(&file, 0, sizeof(file));
+    file.magic = LEVEL_FILE_MAGIC;
+    file.version = LEVEL_FILE_VERSION;
+    file.layout = level_file_layout();
+    file.width = start->width;
+    file.height = start->height;
+    file.tempo = start->tempo;
+    file.n_pacmans = start->n_pacmans;
+    file.n_ghosts = start->n_ghosts;
+    file.n_commands = start->n_commands;
+    file.row_words = start->row_words;
+    file.column_words = start->column_words;
+    char* sources = level_sources(level, &file.sources_size);
+    if (sources == NULL) return -1;
+
+    uint64_t offset = align_section(sizeof(file));
+    for (int i = 0; i < N_SECTIONS; i++) {
+        file.offsets[i] = offset;
+        offset = align_section(offset + section_size(&file, i));
+    }
+
+    // a server mapping the old file keeps it until it unmaps it
+    char* temporary = malloc(strlen(path) + 5);
+    if (temporary == NULL) {
+        free(sources);
+        return -1;
+    }
+    sprintf(temporary, "%s.tmp", path);
+    int fd = open(temporary, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0) {
+        free(sources);
+        free(temporary);
+        return -1;
+    }
+
+    static const char padding[LEVEL_FILE_ALIGN];
+    int result = write_full(fd, &file, sizeof(file)) < 0 ? -1 : 0;
+    uint64_t written = sizeof(file);
+    for (int i = 0; i < N_SECTIONS && result == 0; i++) {
+        const void* data = i == SECTION_SOURCES ? sources : section_data(level, i);
+        if (write_full(fd, padding, file.offsets[i] - written) < 0 ||
+            write_full(fd, data, section_size(&file, i)) < 0) result = -1;
+        written = file.offsets[i] + section_size(&file, i);
+    }
+
+    if (close(fd) < 0) result = -1;
+    if (result == 0 && rename(temporary, path) < 0) result = -1;
+    if (result < 0) unlink(temporary);
+    free(sources);
+    free(temporary);
+    return result;
+}
+
+// Helper private function, whether the layers, passable masks and occupants of a file are the ones its cells and entities give
+static bool derived_valid(const level_file_t* file) {
+    // rebuilt the way a parsed level is, into memory of its own, build_level and build_layers only read the file
+    const char* base = (const char*) file;
+    level_t level;
+    board_t board;
+    memset(&level, 0, sizeof(level));
+    memset(&board, 0, sizeof(board));
+    board.width = file->width;
+    board.height = file->height;
+    board.n_pacmans = file->n_pacmans;
+    board.n_ghosts = file->n_ghosts;
+    board.board = (board_pos_t*) (base + file->offsets[SECTION_CELLS]);
+    board.pacmans = (pacman_t*) (base + file->offsets[SECTION_PACMANS]);
+    board.ghosts = (ghost_t*) (base + file->offsets[SECTION_GHOSTS]);
+    board.level = &level;
+
+    // out of memory, the level is skipped like a file that can't be mapped
+    bool valid = build_level(&board) == 0 && build_layers(&board) == 0;
+    valid = valid &&
+        memcmp(level.layers, base + file->offsets[SECTION_STATIC_LAYERS], section_size(file, SECTION_STATIC_LAYERS)) == 0 &&
+        memcmp(level.passable, base + file->offsets[SECTION_PASSABLE], section_size(file, SECTION_PASSABLE)) == 0 &&
+        memcmp(board.layers, base + file->offsets[SECTION_LAYERS], section_size(file, SECTION_LAYERS)) == 0 &&
+        memcmp(board.occupants, base + file->offsets[SECTION_OCCUPANTS], section_size(file, SECTION_OCCUPANTS)) == 0;
+
+    free(level.layers);
+    free(level.passable);
+    free(board.layers);
+    free(board.occupants);
+    return valid;
+}
+
+// Helper private function, whether a mapped file of size bytes is a level this server can play as it is
+static bool file_valid(const level_file_t* file, size_t size) {
+    if (file->magic != LEVEL_FILE_MAGIC || file->version != LEVEL_FILE_VERSION || file->layout != level_file_layout()) {
+        return false;
+    }
+    if (file->width <= 0 || file->height <= 0 || file->n_pacmans < 0 || file->n_ghosts < 0 || file->n_commands < 0) {
+        return false;
+    }
+    if (file->row_words != (file->width + LAYER_WORD_BITS - 1) / LAYER_WORD_BITS ||
+        file->column_words != (file->height + LAYER_WORD_BITS - 1) / LAYER_WORD_BITS) return false;
+
+    for (int i = 0; i < N_SECTIONS; i++) {
+        if (file->offsets[i] % LEVEL_FILE_ALIGN != 0 || file->offsets[i] > size) return false;
+        if (section_size(file, i) > size - file->offsets[i]) return false;
+    }
+
+    // scripts must stay inside the commands, what moves indexes the board with
+    const char* base = (const char*) file;
+    const pacman_t* pacmans = (const pacman_t*) (base + file->offsets[SECTION_PACMANS]);
+    const ghost_t* ghosts = (const ghost_t*) (base + file->offsets[SECTION_GHOSTS]);
+    const script_t* pacman_scripts = (const script_t*) (base + file->offsets[SECTION_PACMAN_SCRIPTS]);
+    const script_t* ghost_scripts = (const script_t*) (base + file->offsets[SECTION_GHOST_SCRIPTS]);
+    for (int i = 0; i < file->n_pacmans; i++) {
+        if (pacmans[i].pos_x < 0 || pacmans[i].pos_x >= file->width ||
+            pacmans[i].pos_y < 0 || pacmans[i].pos_y >= file->height) return false;
+        if (pacmans[i].n_moves < 0 || pacman_scripts[i].first_move < 0 ||
+            pacman_scripts[i].first_move > file->n_commands - pacmans[i].n_moves) return false;
+    }
+    for (int i = 0; i < file->n_ghosts; i++) {
+        if (ghosts[i].pos_x < 0 || ghosts[i].pos_x >= file->width ||
+            ghosts[i].pos_y < 0 || ghosts[i].pos_y >= file->height) return false;
+        if (ghosts[i].n_moves < 0 || ghost_scripts[i].first_move < 0 ||
+            ghost_scripts[i].first_move > file->n_commands - ghosts[i].n_moves) return false;
+    }
+
+    // the pacman file and one file per ghost, nothing past the last one
+    const char* sources = base + file->offsets[SECTION_SOURCES];
+    int n_strings = 0;
+    for (uint32_t i = 0; i < file->sources_size; i++) {
+        if (sources[i] == '\0') n_strings++;
+    }
+    if (file->sources_size == 0 || sources[file->sources_size - 1] != '\0' || n_strings != 1 + file->n_ghosts) return false;
+
+    // cell states index the glyph table, occupants the entity arrays
+    const unsigned char* cells = (const unsigned char*) (base + file->offsets[SECTION_CELLS]);
+    const int* occupants = (const int*) (base + file->offsets[SECTION_OCCUPANTS]);
+    for (size_t i = 0; i < (size_t) file->width * file->height; i++) {
+        if (cells[i] > (CELL_KIND | CELL_FLAGS)) return false;
+        unsigned char kind = cells[i] & CELL_KIND;
+        if (kind == CELL_PACMAN && (occupants[i] < 0 || occupants[i] >= file->n_pacmans)) return false;
+        if (kind == CELL_GHOST && (occupants[i] < 0 || occupants[i] >= file->n_ghosts)) return false;
+    }
+
+    // what moves trusts instead of the cells, walls and passable masks above all
+    return derived_valid(file);
+}
+
+// Helper private function, dirname/name in a new string, the directory being the one of the level file
+static char* source_path(level_t* level, const char* name) {
+    int dir_length = strrchr(level->path, '/') != NULL ? strrchr(level->path, '/') - level->path + 1 : 0;
+    char* path = malloc(dir_length + strlen(name) + 1);
+    if (path != NULL) sprintf(path, "%.*s%s", dir_length, level->path, name);
+    return path;
+}
+
+// Helper private function, pacman_file and ghosts_files of a mapped level from SECTION_SOURCES, -1 if out of memory
+static int map_sources(level_t* level, const level_file_t* file) {
+    const char* source = (const char*) file + file->offsets[SECTION_SOURCES];
+    if (source[0] != '\0' && (level->pacman_file = source_path(level, source)) == NULL) return -1;
+    source += strlen(source) + 1;
+
+    level->ghosts_files = calloc(file->n_ghosts + 1, sizeof(char*));
+    if (level->ghosts_files == NULL) return -1;
+    for (int i = 0; i < file->n_ghosts; i++) {
+        if ((level->ghosts_files[i] = source_path(level, source)) == NULL) return -1;
+        source += strlen(source) + 1;
+    }
+    return 0;
+}
+
+level_t* level_map(char* path, char* name) {
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) return NULL;
+
+    struct stat st;
+    void* map = MAP_FAILED;
+    if (fstat(fd, &st) == 0 && (size_t) st.st_size >= sizeof(level_file_t)) {
+        map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    }
+    close(fd);
+    if (map == MAP_FAILED) return NULL;
+
+    level_file_t* file = map;
+    if (!file_valid(file, st.st_size)) {
+        debug("%s is not a level file of this server\n", path);
+        munmap(map, st.st_size);
+        return NULL;
+    }
+
+    level_t* level = calloc(1, sizeof(level_t));
+    if (level == NULL) {
+        munmap(map, st.st_size);
+        return NULL;
+    }
+    atomic_init(&level->refs, 1);
+    level->map = map;
+    level->map_size = st.st_size;
+    level->path = strdup(path);
+    level->name = strdup(name);
+    level->start = calloc(1, sizeof(board_t));
+    if (level->path == NULL || level->name == NULL || level->start == NULL || map_sources(level, file) < 0) {
+        level_release(level);
+        return NULL;
+    }
+
+    // nothing is copied, every array points into the mapping
+    char* base = map;
+    level->layers = (atomic_ullong*) (base + file->offsets[SECTION_STATIC_LAYERS]);
+    level->passable = (unsigned char*) (base + file->offsets[SECTION_PASSABLE]);
+
+    board_t* start = level->start;
+    start->width = file->width;
+    start->height = file->height;
+    start->tempo = file->tempo;
+    start->n_pacmans = file->n_pacmans;
+    start->n_ghosts = file->n_ghosts;
+    start->n_commands = file->n_commands;
+    start->row_words = file->row_words;
+    start->column_words = file->column_words;
+    start->board = (board_pos_t*) (base + file->offsets[SECTION_CELLS]);
+    start->layers = (atomic_ullong*) (base + file->offsets[SECTION_LAYERS]);
+    start->occupants = (atomic_int*) (base + file->offsets[SECTION_OCCUPANTS]);
+    start->pacmans = (pacman_t*) (base + file->offsets[SECTION_PACMANS]);
+    start->ghosts = (ghost_t*) (base + file->offsets[SECTION_GHOSTS]);
+    start->pacman_scripts = (script_t*) (base + file->offsets[SECTION_PACMAN_SCRIPTS]);
+    start->ghost_scripts = (script_t*) (base + file->offsets[SECTION_GHOST_SCRIPTS]);
+    start->commands = (command_t*) (base + file->offsets[SECTION_COMMANDS]);
+    start->level = level;
+    start->session_active = true;
+    return level;
+}
@@ -0,0 +1,96 @@
+#include "brlock.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <unistd.h>
+
+/*
+Read side throughput of the board state lock against the pthread_rwlock it
+replaced, with 1, 2, 4... threads up to twice the number of cores online.
+Usage: lock_bench [milliseconds per run]
+*/
+
+#define LOCK_RWLOCK 0
+#define LOCK_BRLOCK 1
+
+typedef struct {
+    int kind; // LOCK_RWLOCK or LOCK_BRLOCK
+    pthread_rwlock_t rwlock;
+    brlock_t brlock;
+    atomic_bool running;
+} bench_t;
+
+typedef struct {
+    _Alignas(CACHE_LINE_SIZE) bench_t* bench;
+    int reader;
+    unsigned long reads;
+    pthread_t tid;
+} bench_reader_t;
+
+static void* reader_thread(void* arg) {
+    bench_reader_t* reader = (bench_reader_t*) arg;
+    bench_t* bench = reader->bench;
+    unsigned long reads = 0;
+
+    while (atomic_load_explicit(&bench->running, memory_order_relaxed)) {
+        if (bench->kind == LOCK_RWLOCK) {
+            pthread_rwlock_rdlock(&bench->rwlock);
+            pthread_rwlock_unlock(&bench->rwlock);
+        } else {
+            brlock_read_lock(&bench->brlock, reader->reader);
+            brlock_read_unlock(&bench->brlock, reader->reader);
+        }
+        reads++;
+    }
+    reader->reads = reads;
+    return NULL;
+}
+
+// Helper private function, millions of read locks per second taken by n_threads readers
+static double run(int kind, int n_threads, int milliseconds) {
+    bench_t bench;
+    bench.kind = kind;
+    pthread_rwlock_init(&bench.rwlock, NULL);
+    brlock_init(&bench.brlock, n_threads);
+    atomic_init(&bench.running, true);
+
+    bench_reader_t* readers = aligned_alloc(CACHE_LINE_SIZE, n_threads * sizeof(bench_reader_t));
+    for (int i = 0; i < n_threads; i++) {
+        readers[i].bench = &bench;
+        readers[i].reader = i;
+        pthread_create(&readers[i].tid, NULL, reader_thread, &readers[i]);
+    }
+
+    struct timespec ts = {milliseconds / 1000, (milliseconds % 1000) * 1000000L};
+    nanosleep(&ts, NULL);
+    atomic_store(&bench.running, false);
+
+    unsigned long total = 0;
+    for (int i = 0; i < n_threads; i++) {
+        pthread_join(readers[i].tid, NULL);
+        total += readers[i].reads;
+    }
+
+    free(readers);
+    brlock_destroy(&bench.brlock);
+    pthread_rwlock_destroy(&bench.rwlock);
+    return total / (milliseconds * 1000.0);
+}
+
+int main(int argc, char** argv) {
+    int milliseconds = argc > 1 ? atoi(argv[1]) : 1000;
+    if (milliseconds <= 0) {
+        fprintf(stderr, "Usage: %s [milliseconds per run]\n", argv[0]);
+        return 1;
+    }
+    long cores = sysconf(_SC_NPROCESSORS_ONLN);
+
+    printf("%ld cores online, %d ms per run\n", cores, milliseconds);
+    printf("%8s %16s %16s %8s\n", "threads", "rwlock Mreads/s", "brlock Mreads/s", "speedup");
+    for (int n_threads = 1; n_threads <= 2 * cores; n_threads *= 2) {
+        double rwlock = run(LOCK_RWLOCK, n_threads, milliseconds);
+        double brlock = run(LOCK_BRLOCK, n_threads, milliseconds);
+        printf("%8d %16.2f %16.2f %7.1fx\n", n_threads, rwlock, brlock, brlock / rwlock);
+    }
+    return 0;
+}
@@ -4,33 +4,60 @@
 #include <unistd.h>
 #include "parser.h"
 #include "board.h"
+#include "protocol.h"
 #include <fcntl.h>
+#include <sys/stat.h>
+
+// Helper private function, dirname/name in a new string
+static char* join_path(char* dirname, char* name) {
+    char* path = malloc(strlen(dirname) + strlen(name) + 2);
+    if (path != NULL) sprintf(path, "%s/%s", dirname, name);
+    return path;
+}
+
+// Helper private function, appends a move to the scripts of the board, -1 if out of memory
+static int add_move(board_t* board, char command, int turns) {
+    // the array doubles whenever it is full, so it is full exactly at zero and at powers of two from 8 on
+    int n = board->n_commands;
+    if (n == 0 || (n >= 8 && (n & (n - 1)) == 0)) {
+        command_t* commands = realloc(board->commands, (n == 0 ? 8 : 2 * n) * sizeof(command_t));
+        if (commands == NULL) return -1;
+        board->commands = commands;
+    }
+
+    memset(&board->commands[n], 0, sizeof(command_t)); // padding included, levelc writes it out
+    board->commands[n].command = command;
+    board->commands[n].turns = turns;
+    board->commands[n].turns_left = turns;
+    board->n_commands++;
+    return 0;
+}
 
 int read_level(board_t* board, char* filename, char* dirname) {
+    level_t* level = board->level;
 
-    char fullname[MAX_FILENAME];
-    strcpy(fullname, dirname);
-    strcat(fullname, "/");
-    strcat(fullname, filename);
+    char* fullname = join_path(dirname, filename);
+    if (fullname == NULL) return -1;
 
-    int fd = open(fullname, O_RDONLY);
-    if (fd == -1) {
+    line_reader_t reader;
+    if (reader_open(&reader, fullname) < 0) {
         debug("Error opening file %s\n", fullname);
+        free(fullname);
         return -1;
     }
+    free(fullname);
     
-    char command[MAX_COMMAND_LENGTH];
+    char* command;
 
     // Pacman is optional
-    board->pacman_file[0] = '\0';
+    level->pacman_file = NULL;
     board->n_pacmans = 1;
     board->session_active = true;
 
-    strcpy(board->level_name, filename);
-    *strrchr(board->level_name, '.') = '\0';
+    level->name = strdup(filename);
+    *strrchr(level->name, '.') = '\0';
 
-    int read;
-    while ((read = read_line(fd, command)) > 0) {
+    while ((command = reader_next(&reader)) != NULL) {
 
         // comment
         if (command[0] == '#' || command[0] == '\0') continue;
@@ -59,8 +86,9 @@ int read_level(board_t* board, char* filename, char* dirname) {
         else if (strcmp(word, "PAC") == 0) {
             char *arg = strtok(NULL, " \t\n");
             if (arg) {
-                snprintf(board->pacman_file, sizeof(board->pacman_file), "%s/%s", dirname, arg);
-                debug("PAC = %s\n", board->pacman_file);
+                free(level->pacman_file);
+                level->pacman_file = join_path(dirname, arg);
+                debug("PAC = %s\n", level->pacman_file);
             }
         }
 
@@ -68,10 +96,13 @@ int read_level(board_t* board, char* filename, char* dirname) {
             char *arg;
             int i = 0;
             while ((arg = strtok(NULL, " \t\n")) != NULL) {
-                snprintf(board->ghosts_files[i], sizeof(board->ghosts_files[0]), "%s/%s", dirname, arg);
-                debug("MON file: %s\n", board->ghosts_files[i]);
+                char** files = realloc(level->ghosts_files, (i + 2) * sizeof(char*));
+                if (files == NULL) break;
+                level->ghosts_files = files;
+                files[i] = join_path(dirname, arg);
+                files[i + 1] = NULL;
+                debug("MON file: %s\n", files[i]);
                 i+= 1;
-                if (i == MAX_GHOSTS-1) break;
             }
             board->n_ghosts = i;
         }
@@ -83,7 +114,7 @@ int read_level(board_t* board, char* filename, char* dirname) {
 
     if (!board->width || !board->height) {
         debug("Missing dimensions in level file\n");
-        close(fd);
+        reader_close(&reader);
         return -1;
     }
     
@@ -91,45 +122,40 @@ int read_level(board_t* board, char* filename, char* dirname) {
     board->board = calloc(board->width * board->height, sizeof(board_pos_t));
     board->pacmans = calloc(board->n_pacmans, sizeof(pacman_t));
     board->ghosts = calloc(board->n_ghosts, sizeof(ghost_t));
+    board->pacman_scripts = calloc(board->n_pacmans, sizeof(script_t));
+    board->ghost_scripts = calloc(board->n_ghosts, sizeof(script_t));
 
     int row = 0;
     // command here still holds the previous line
-    while (read > 0) {
+    for (; command != NULL; command = reader_next(&reader)) {
         if (command[0]== '#' || command[0] == '\0') continue;
         if (row >= board->height) break;
 
         //debug("Line: %s\n", command);
 
+        // cells past the end of a short line get a dot, like any character that is not a wall or a portal
+        size_t length = strlen(command);
         for (int col = 0; col < board -> width; col++){
             int idx = row * board->width + col;
-            char content = command[col];
+            char content = (size_t) col < length ? command[col] : ' ';
 
             switch (content) {
                 case 'X': // wall
-                    board->board[idx].content = 'W';
+                    atomic_init(&board->board[idx].state, CELL_WALL);
                     break;
                 case '@': // portal
-                    board->board[idx].content = ' ';
-                    board->board[idx].has_portal = 1;
+                    atomic_init(&board->board[idx].state, CELL_EMPTY | CELL_PORTAL);
                     break;
                 default:
-                    board->board[idx].content = ' ';
-                    board->board[idx].has_dot = 1;
+                    atomic_init(&board->board[idx].state, CELL_EMPTY | CELL_DOT);
                     break;
             }
         }
 
         row++;
-        read = read_line(fd, command);
-    }
-
-    if (read == -1) {
-      debug("Failed parsing line");
-      close(fd);
-      return read;
     }
 
-    close(fd);
+    reader_close(&reader);
     return 0;
 }
 
@@ -139,7 +165,7 @@ int read_pacman(board_t* board, int points) {
     pacman->points = points;
 
     // no file was provided -> defaults 
-    if (board->pacman_file[0] == '\0') {
+    if (board->level->pacman_file == NULL) {
         pacman->passo = 0;
         pacman->waiting = 0;
         pacman->n_moves = 0; // user controlled
@@ -147,10 +173,10 @@ int read_pacman(board_t* board, int points) {
         for (int i = 0; i < board->height; i++) {
             for (int j = 0; j < board->width; j++) {
                 int idx = i * board->width + j;
-                if (board->board[idx].content == ' ') {
+                if (cell_kind(&board->board[idx]) == CELL_EMPTY) {
                     pacman->pos_x = j;
                     pacman->pos_y = i;
-                    board->board[idx].content = 'P';
+                    cell_place(&board->board[idx], CELL_PACMAN);
                     goto pacman_inserted;
                 }
             }
@@ -160,11 +186,14 @@ int read_pacman(board_t* board, int points) {
         return 0;
     }
 
-    int fd = open(board->pacman_file, O_RDONLY);
+    line_reader_t reader;
+    if (reader_open(&reader, board->level->pacman_file) < 0) {
+        debug("Error opening file %s\n", board->level->pacman_file);
+        return -1;
+    }
 
-    int read;
-    char command[MAX_COMMAND_LENGTH];
-    while ((read = read_line(fd, command)) > 0) {
+    char* command;
+    while ((command = reader_next(&reader)) != NULL) {
         // comment
         if (command[0] == '#' || command[0] == '\0') continue;
 
@@ -186,7 +215,7 @@ int read_pacman(board_t* board, int points) {
                 pacman->pos_x = atoi(arg1);
                 pacman->pos_y = atoi(arg2);
                 int idx = pacman->pos_y * board->width + pacman->pos_x;
-                board->board[idx].content = 'P';
+                cell_place(&board->board[idx], CELL_PACMAN);
                 debug("Pacman Pos = %d x %d\n", pacman->pos_x, pacman->pos_y);
             }
         }
@@ -197,10 +226,12 @@ int read_pacman(board_t* board, int points) {
 
     // end of the file contains the moves
     pacman->current_move = 0;
+    board->pacman_scripts[0].first_move = board->n_commands;
     
     // command here still holds the previous line
     int move = 0;
-    while (read > 0 && move < MAX_MOVES) {
+    int result = 0;
+    for (; command != NULL; command = reader_next(&reader)) {
         if (command[0]== '#' || command[0] == '\0') continue;
         if (command[0] == 'A' ||
             command[0] == 'D' ||
@@ -209,43 +240,36 @@ int read_pacman(board_t* board, int points) {
             command[0] == 'R' ||
             command[0] == 'G' ||  // FIXME: so para testar
             command[0] == 'Q') {  // FIXME: so para testar
-                pacman->moves[move].command = command[0];
-                pacman->moves[move].turns = 1;
+                if ((result = add_move(board, command[0], 1)) < 0) break;
                 move += 1;
         }
         else if (command[0] == 'T' && command[1] == ' ') { 
             int t = atoi(command+2);
             if (t > 0) {
-                pacman->moves[move].command = command[0];
-                pacman->moves[move].turns = t;
-                pacman->moves[move].turns_left = t;
+                if ((result = add_move(board, command[0], t)) < 0) break;
                 move += 1;
             }
         }
-
-        read = read_line(fd, command);
     }
     pacman->n_moves = move;
 
-    if (read == -1) {
-        debug("Failed reading line\n");
-        close(fd);
-        return -1;
-    }
-
-    close(fd);
-    return 0;
+    if (result < 0) debug("Out of memory for the pacman moves\n");
+    reader_close(&reader);
+    return result;
 }
 
 
 int read_ghosts(board_t* board) {
     for (int i = 0; i < board->n_ghosts; i++) {
-        int fd = open(board->ghosts_files[i], O_RDONLY);
         ghost_t* ghost = &board->ghosts[i];
+        line_reader_t reader;
+        if (reader_open(&reader, board->level->ghosts_files[i]) < 0) {
+            debug("Error opening file %s\n", board->level->ghosts_files[i]);
+            return -1;
+        }
 
-        int read;
-        char command[MAX_COMMAND_LENGTH];
-        while ((read = read_line(fd, command)) > 0) {
+        char* command;
+        while ((command = reader_next(&reader)) != NULL) {
             // comment
             if (command[0] == '#' || command[0] == '\0') continue;
 
@@ -267,7 +291,7 @@ int read_ghosts(board_t* board) {
                     ghost->pos_x = atoi(arg1);
                     ghost->pos_y = atoi(arg2);
                     int idx = ghost->pos_y * board->width + ghost->pos_x;
-                    board->board[idx].content = 'M';
+                    cell_place(&board->board[idx], CELL_GHOST);
                     //debug("Ghost Pos = %d x %d\n", ghost->pos_x, ghost->pos_y);
                 }
             }
@@ -278,10 +302,12 @@ int read_ghosts(board_t* board) {
 
         // end of the file contains the moves
         ghost->current_move = 0;
+        board->ghost_scripts[i].first_move = board->n_commands;
 
         // command here still holds the previous line
         int move = 0;
-        while (read > 0 && move < MAX_MOVES) {
+        int result = 0;
+        for (; command != NULL; command = reader_next(&reader)) {
             if (command[0]== '#' || command[0] == '\0') continue;
             if (command[0] == 'A' ||
                 command[0] == 'D' ||
@@ -289,48 +315,66 @@ int read_ghosts(board_t* board) {
                 command[0] == 'S' ||
                 command[0] == 'R' ||
                 command[0] == 'C') {
-                    ghost->moves[move].command = command[0];
-                    ghost->moves[move].turns = 1; 
+                    if ((result = add_move(board, command[0], 1)) < 0) break;
                     move += 1;
             }
             else if (command[0] == 'T' && command[1] == ' ') {
                 int t = atoi(command+2);
                 if (t > 0) {
-                    ghost->moves[move].command = command[0];
-                    ghost->moves[move].turns = t;
-                    ghost->moves[move].turns_left = t;
+                    if ((result = add_move(board, command[0], t)) < 0) break;
                     move += 1;
                 }
             }
-            read = read_line(fd, command);
         }
         ghost->n_moves = move;
 
-        if (read == -1) {
-            debug("Failed reading line\n");
-            close(fd);
+        reader_close(&reader);
+        if (result < 0) {
+            debug("Out of memory for the moves of ghost %d\n", i);
             return -1;
         }
-        close(fd);
     }
 
     return 0;
 }
 
-int read_line(int fd, char *buf) {
-    int i = 0;
-    char c;
-    ssize_t n;
+int reader_open(line_reader_t* reader, const char* path) {
+    int fd = open(path, O_RDONLY);
+    if (fd == -1) return -1;
 
-    while ((n = read(fd, &c, 1)) == 1) {
-        if (c == '\r') continue;
-        if (c == '\n') break;
-        buf[i++] = c;
-        if (i == MAX_COMMAND_LENGTH - 1) break;
+    // one read for the whole file, the lines are then cut in place
+    struct stat st;
+    if (fstat(fd, &st) < 0 || (reader->data = malloc(st.st_size + 1)) == NULL) {
+        close(fd);
+        return -1;
+    }
+    if (read_full(fd, reader->data, st.st_size) < 0) {
+        free(reader->data);
+        close(fd);
+        return -1;
     }
+    close(fd);
+
+    reader->data[st.st_size] = '\0';
+    reader->size = st.st_size;
+    reader->next = 0;
+    return 0;
+}
+
+char* reader_next(line_reader_t* reader) {
+    if (reader->next >= reader->size) return NULL;
+
+    char* line = reader->data + reader->next;
+    char* end = memchr(line, '\n', reader->size - reader->next);
+    if (end == NULL) end = reader->data + reader->size; // last line with no newline, already terminated
+    reader->next = end - reader->data + 1;
+
+    *end = '\0';
+    if (end > line && end[-1] == '\r') end[-1] = '\0';
+    return line;
+}
 
-    buf[i] = '\0';
-    if (n == -1) return -1;
-    if (n == 0 && i == 0) return 0;
-    return i;                         
+void reader_close(line_reader_t* reader) {
+    free(reader->data);
+    reader->data = NULL;
 }
@@ -0,0 +1,847 @@
+#include "reactor.h"
+#include "tick.h"
+#include "scheduler.h"
+#include "wheel.h"
+#include "affinity.h"
+#include "shard.h"
+#include "handoff.h"
+#include "protocol.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/timerfd.h>
+#include <sched.h>
+
+typedef enum {
+    SESSION_CONNECTING, // waiting for the client to open its notification pipe
+    SESSION_PLAYING, // one tick task per timer expiration
+    SESSION_DISCONNECTING, // last frames still being written
+    SESSION_CLOSED, // freed once the current batch of events is handled
+} session_state_t;
+
+typedef enum {
+    HANDLE_WAKE,
+    HANDLE_WHEEL,
+    HANDLE_REQUEST,
+    HANDLE_NOTIFICATION,
+} handle_kind_t;
+
+typedef struct reactor_session reactor_session_t;
+typedef struct reactor_worker reactor_worker_t;
+
+typedef struct {
+    reactor_session_t* session; // NULL for the handles of the worker itself
+    handle_kind_t kind;
+} reactor_handle_t;
+
+struct reactor_session {
+    pthread_mutex_t lock; // the owner worker and whoever runs its tick task
+    session_state_t state;
+    bool tick_queued; // a tick task is waiting in some deque
+    int result; // what the last tick returned, handled by the owner
+    char client_request_pipe[MAX_PIPE_PATH_LENGTH + 1];
+    char client_notification_pipe[MAX_PIPE_PATH_LENGTH + 1];
+    reactor_worker_t* owner;
+    wheel_timer_t timer; // on the wheel of the owner
+    unsigned long missed_reported; // missed deadlines already written to the debug file
+    int client_request_fd;
+    int client_notification_fd;
+    int connect_attempts;
+    catalog_t* catalog; // version the game plays, taken when its first level starts
+    int current_level;
+    int accumulated_points;
+    uint64_t seed; // every random move of the session derives from it
+    bool level_loaded;
+    arena_t arena; // the board of the current level is carved from it
+    arena_mark_t level_mark; // where the board of the current level starts in the arena
+    board_t board;
+    tick_session_t tick;
+    reactor_handle_t request_handle;
+    reactor_handle_t notification_handle;
+    reactor_session_t* next; // inbox or graveyard link
+    reactor_session_t* prev_running; // worker list of sessions not closed yet
+    reactor_session_t* next_running;
+};
+
+struct reactor_worker {
+    pthread_t tid;
+    int index; // also the index of its deque in the scheduler
+    int epoll_fd;
+    int wake_fd; // eventfd signalled when the inbox gets a session
+    int wheel_fd; // timerfd set to the next deadline on the wheel
+    long long wheel_armed; // millisecond wheel_fd is set to, -1 when disarmed
+    atomic_bool idle; // blocked on epoll with no task left to run
+    int next_wake; // where the search for a worker to steal from this one starts
+    timer_wheel_t wheel; // timers of every session this worker owns
+    reactor_handle_t wake_handle;
+    reactor_handle_t wheel_handle;
+    pthread_mutex_t inbox_lock;
+    reactor_session_t* inbox;
+    reactor_session_t* graveyard; // sessions closed during the current batch
+    reactor_session_t* running;
+    reactor_t* reactor;
+};
+
+struct reactor {
+    int n_workers;
+    int next_worker;
+    reactor_worker_t* workers;
+    scheduler_t* scheduler; // tick tasks, shared by every worker
+    ghost_pool_t* ghost_pool;
+    pthread_mutex_t backlog_lock;
+    int free_slots; // sessions that can still be started
+    reactor_session_t* backlog; // clients waiting for a free slot, oldest first
+    reactor_session_t* backlog_tail;
+    atomic_bool shutdown;
+    atomic_bool handing_off; // sessions are kept for the next server when the workers stop
+};
+
+// Fixed part of a session handed to the next server, its tick state and board follow it
+typedef struct {
+    session_state_t state; // SESSION_CLOSED marks the end of the sessions
+    int result;
+    char client_request_pipe[MAX_PIPE_PATH_LENGTH + 1];
+    char client_notification_pipe[MAX_PIPE_PATH_LENGTH + 1];
+    int connect_attempts;
+    char last_level[MAX_FILENAME + 1]; // name of the last level started, empty before the first one
+    int accumulated_points;
+    uint64_t seed;
+    bool level_loaded;
+} session_record_t;
+
+// Helper private function, arms the session timer, periodic when interval_ms is not 0
+static void arm_timer(reactor_session_t* session, int first_ms, int interval_ms) {
+    wheel_schedule(&session->owner->wheel, &session->timer, first_ms, interval_ms);
+}
+
+// Helper private function, sets the wheel timerfd to the next deadline on the wheel
+static void arm_wheel(reactor_worker_t* worker) {
+    long long next = wheel_next_expiry(&worker->wheel);
+    if (next == worker->wheel_armed) return;
+    worker->wheel_armed = next;
+
+    struct itimerspec spec;
+    memset(&spec, 0, sizeof(spec)); // a zero value disarms it
+    if (next >= 0) {
+        unsigned long long ns = wheel_to_ns(&worker->wheel, next);
+        spec.it_value.tv_sec = ns / 1000000000ULL;
+        spec.it_value.tv_nsec = ns % 1000000000ULL;
+    }
+    timerfd_settime(worker->wheel_fd, TFD_TIMER_ABSTIME, &spec, NULL);
+}
+
+static void close_session(reactor_worker_t* worker, reactor_session_t* session) {
+    if (session->state == SESSION_CLOSED) return;
+    debug("Closing session of %s\n", session->client_notification_pipe);
+
+    wheel_cancel(&worker->wheel, &session->timer);
+    if (session->client_request_fd >= 0) close(session->client_request_fd);
+    if (session->client_notification_fd >= 0) close(session->client_notification_fd);
+    if (session->level_loaded) unload_level(&session->board);
+    tick_destroy(&session->tick);
+    debug("Session of %s used at most %zu bytes\n", session->client_notification_pipe, session->arena.peak);
+
+    if (session->prev_running) session->prev_running->next_running = session->next_running;
+    else worker->running = session->next_running;
+    if (session->next_running) session->next_running->prev_running = session->prev_running;
+
+    // other events of this batch may still point to the session
+    session->state = SESSION_CLOSED;
+    session->next = worker->graveyard;
+    worker->graveyard = session;
+}
+
+// Helper private function, loads the next level and starts ticking it
+static int start_level(reactor_session_t* session) {
+    if (session->catalog == NULL) session->catalog = catalog_acquire();
+    level_t* level = catalog_level(session->catalog, session->current_level);
+    if (level == NULL) return -1;
+    session->level_mark = arena_mark(&session->arena);
+    if (load_level(&session->board, level, session->accumulated_points, &session->arena) < 0) {
+        arena_rewind(&session->arena, session->level_mark);
+        return -1;
+    }
+    seed_level(&session->board, session->seed, session->current_level);
+    affinity_bind_board(&session->board);
+
+    session->level_loaded = true;
+    session->current_level++;
+    session->result = CONTINUE_PLAY;
+    tick_start_level(&session->tick, &session->board);
+    arm_timer(session, session->board.tempo, session->board.tempo);
+    return 0;
+}
+
+// Helper private function, sends the last frame of a level and decides what comes next
+static void end_level(reactor_worker_t* worker, reactor_session_t* session, int result) {
+    int victory = 0;
+    int game_over = 0;
+
+    if (result == NEXT_LEVEL && session->current_level >= session->catalog->n_levels) {
+        debug("All levels completed. Victory! current_level=%d total_levels=%d\n", session->current_level, session->catalog->n_levels);
+        victory = 1;
+    }
+    else if (result != NEXT_LEVEL) {
+        // there are no fork backups in this engine, a dead pacman ends the game
+        game_over = 1;
+    }
+
+    int sent = tick_send_frame(&session->tick, victory, game_over);
+    unload_level(&session->board);
+    arena_rewind(&session->arena, session->level_mark);
+    session->level_loaded = false;
+
+    if (sent < 0) {
+        close_session(worker, session);
+        return;
+    }
+
+    if (!victory && !game_over) {
+        if (start_level(session) < 0) close_session(worker, session);
+        return;
+    }
+
+    session->state = SESSION_DISCONNECTING;
+    if (session->tick.output_size == 0) {
+        close_session(worker, session);
+        return;
+    }
+    arm_timer(session, DISCONNECT_TIMEOUT_MS, 0);
+}
+
+// Helper private function, registers both client pipes of a session with the worker's epoll
+static void watch_pipes(reactor_worker_t* worker, reactor_session_t* session) {
+    struct epoll_event event;
+    event.events = EPOLLIN | EPOLLET;
+    event.data.ptr = &session->request_handle;
+    epoll_ctl(worker->epoll_fd, EPOLL_CTL_ADD, session->client_request_fd, &event);
+    event.events = EPOLLOUT | EPOLLET;
+    event.data.ptr = &session->notification_handle;
+    epoll_ctl(worker->epoll_fd, EPOLL_CTL_ADD, session->client_notification_fd, &event);
+}
+
+// Helper private function, tries to open the notification pipe of a connecting client
+static void try_connect(reactor_worker_t* worker, reactor_session_t* session) {
+    session->client_notification_fd = open(session->client_notification_pipe, O_WRONLY | O_NONBLOCK);
+    if (session->client_notification_fd < 0) {
+        if (errno == ENXIO && ++session->connect_attempts < CONNECT_ATTEMPTS) return; // no reader yet
+        perror("open client fifo");
+        close_session(worker, session);
+        return;
+    }
+
+    char message[2];
+    message[0] = (char)('0' + OP_CODE_CONNECT);
+    message[1] = '0';
+    debug("Sending return message to connect (2 bytes): op=%c result=%c\n", message[0], message[1]);
+    if (write_full(session->client_notification_fd, message, sizeof(message)) < 0) {
+        close_session(worker, session);
+        return;
+    }
+
+    session->client_request_fd = open(session->client_request_pipe, O_RDWR | O_NONBLOCK);
+    if (session->client_request_fd < 0) {
+        perror("open client request fifo");
+        close_session(worker, session);
+        return;
+    }
+
+    watch_pipes(worker, session);
+
+    session->seed = rng_session_seed();
+    debug("Session of %s seeded with %llu\n", session->client_notification_pipe, (unsigned long long) session->seed);
+
+    tick_init(&session->tick, session->client_request_fd, session->client_notification_fd, &session->accumulated_points,
+              worker->reactor->ghost_pool);
+    session->state = SESSION_PLAYING;
+    if (start_level(session) < 0) close_session(worker, session);
+}
+
+// Helper private function, gets a worker out of epoll_wait
+static void wake_worker(reactor_worker_t* worker) {
+    uint64_t one = 1;
+    if (write(worker->wake_fd, &one, sizeof(one)) < 0) perror("write wake fd");
+}
+
+// Task run by any worker, advances a session by one tick
+// Helper private function, advances the session one tick, its lock held
+static void advance_session(reactor_session_t* session) {
+    session->tick_queued = false;
+    if (session->state == SESSION_PLAYING && session->result == CONTINUE_PLAY) {
+        int result = tick_advance(&session->tick);
+        if (result == CREATE_BACKUP) {
+            debug("Backups are not available in the reactor engine\n");
+            result = CONTINUE_PLAY;
+        }
+        // level transitions touch the owner's lists, so they wait for its next timer
+        session->result = result;
+    }
+}
+
+static void run_tick(void* arg) {
+    reactor_session_t* session = (reactor_session_t*) arg;
+
+    pthread_mutex_lock(&session->lock);
+    advance_session(session);
+    pthread_mutex_unlock(&session->lock);
+}
+
+// Helper private function, wakes another worker to steal from the backed-up deque of this one, an idle one if any
+static void wake_thief(reactor_worker_t* worker) {
+    reactor_t* reactor = worker->reactor;
+    int n = reactor->n_workers;
+    if (n < 2) return;
+
+    // the search starts somewhere else every time, so no worker is always the one woken
+    int first = worker->next_wake;
+    worker->next_wake = (worker->next_wake + 1) % (n - 1);
+    reactor_worker_t* thief = &reactor->workers[(worker->index + 1 + first) % n];
+    for (int i = 0; i < n - 1; i++) {
+        reactor_worker_t* candidate = &reactor->workers[(worker->index + 1 + (first + i) % (n - 1)) % n];
+        if (atomic_load(&candidate->idle)) {
+            thief = candidate;
+            break;
+        }
+    }
+    wake_worker(thief);
+}
+
+static void on_timer(reactor_worker_t* worker, reactor_session_t* session) {
+    switch (session->state) {
+        case SESSION_CONNECTING:
+            try_connect(worker, session);
+            break;
+        case SESSION_PLAYING:
+            if (session->result != CONTINUE_PLAY) {
+                end_level(worker, session, session->result);
+                break;
+            }
+            if (session->timer.missed > session->missed_reported) {
+                debug("Session of %s missed %lu tick deadlines\n", session->client_notification_pipe,
+                      session->timer.missed - session->missed_reported);
+                session->missed_reported = session->timer.missed;
+            }
+            if (session->tick_queued) {
+                // the last tick has not run yet, this deadline is missed too
+                session->timer.missed++;
+                break;
+            }
+            session->tick_queued = true;
+            int queued = scheduler_push(worker->reactor->scheduler, worker->index, (task_t) {run_tick, session});
+            if (queued < 0) {
+                // no room to queue it, the owner runs it right away
+                advance_session(session);
+            } else if (queued > 1) {
+                // a backlog means some other worker should come and steal
+                wake_thief(worker);
+            }
+            break;
+        case SESSION_DISCONNECTING:
+            debug("Client did not read its last frames\n");
+            close_session(worker, session);
+            break;
+        case SESSION_CLOSED:
+            break;
+    }
+}
+
+// Called by the wheel of the owner when a session deadline comes
+static void on_session_timer(wheel_timer_t* timer) {
+    reactor_session_t* session = (reactor_session_t*) timer->arg;
+
+    pthread_mutex_lock(&session->lock);
+    if (session->state != SESSION_CLOSED) on_timer(session->owner, session);
+    pthread_mutex_unlock(&session->lock);
+}
+
+static void on_request(reactor_worker_t* worker, reactor_session_t* session) {
+    if (session->state != SESSION_PLAYING) return;
+    if (tick_read_requests(&session->tick) < 0) close_session(worker, session);
+}
+
+static void on_notification(reactor_worker_t* worker, reactor_session_t* session, uint32_t events) {
+    if (events & EPOLLERR) { // the client closed its end
+        close_session(worker, session);
+        return;
+    }
+
+    int pending = tick_flush(&session->tick);
+    if (pending < 0 || (pending == 0 && session->state == SESSION_DISCONNECTING)) {
+        close_session(worker, session);
+    }
+}
+
+// Helper private function, gives a session to the next worker in turn
+static void dispatch(reactor_t* reactor, reactor_session_t* session) {
+    pthread_mutex_lock(&reactor->backlog_lock);
+    reactor_worker_t* worker = &reactor->workers[reactor->next_worker];
+    reactor->next_worker = (reactor->next_worker + 1) % reactor->n_workers;
+    pthread_mutex_unlock(&reactor->backlog_lock);
+
+    pthread_mutex_lock(&worker->inbox_lock);
+    session->next = worker->inbox;
+    worker->inbox = session;
+    pthread_mutex_unlock(&worker->inbox_lock);
+
+    wake_worker(worker);
+}
+
+// Helper private function, frees a session along with everything carved from its arena
+static void free_session(reactor_session_t* session) {
+    if (session->catalog != NULL) catalog_release(session->catalog);
+    pthread_mutex_destroy(&session->lock);
+    arena_destroy(&session->arena);
+    free(session);
+}
+
+// Helper private function, hands the slot of a finished session to the oldest waiting client
+static void release_slot(reactor_t* reactor) {
+    pthread_mutex_lock(&reactor->backlog_lock);
+    reactor_session_t* waiting = atomic_load(&reactor->handing_off) ? NULL : reactor->backlog; // the next server gets the backlog
+    if (waiting != NULL) {
+        reactor->backlog = waiting->next;
+        if (reactor->backlog == NULL) reactor->backlog_tail = NULL;
+    } else {
+        reactor->free_slots++;
+    }
+    pthread_mutex_unlock(&reactor->backlog_lock);
+
+    if (waiting == NULL) return;
+    if (atomic_load(&reactor->shutdown)) free_session(waiting); // workers are stopping, nobody would adopt it
+    else dispatch(reactor, waiting);
+}
+
+// Helper private function, registers the sessions handed over by the dispatcher
+static void adopt_inbox(reactor_worker_t* worker) {
+    uint64_t count;
+    if (read(worker->wake_fd, &count, sizeof(count)) < 0 && errno != EAGAIN) perror("read wake fd");
+
+    pthread_mutex_lock(&worker->inbox_lock);
+    reactor_session_t* session = worker->inbox;
+    worker->inbox = NULL;
+    pthread_mutex_unlock(&worker->inbox_lock);
+
+    while (session != NULL) {
+        reactor_session_t* next = session->next;
+
+        session->owner = worker;
+        session->timer.fire = on_session_timer;
+        session->timer.arg = session;
+        if (session->state == SESSION_CONNECTING) {
+            arm_timer(session, 1, CONNECT_RETRY_MS);
+        } else {
+            // handed over by the previous server, it goes on where it was
+            watch_pipes(worker, session);
+            if (session->state == SESSION_DISCONNECTING) arm_timer(session, DISCONNECT_TIMEOUT_MS, 0);
+            else arm_timer(session, session->board.tempo, session->board.tempo);
+        }
+
+        session->prev_running = NULL;
+        session->next_running = worker->running;
+        if (worker->running) worker->running->prev_running = session;
+        worker->running = session;
+
+        session = next;
+    }
+}
+
+// Helper private function, frees the closed sessions no tick task points to anymore
+static void bury_sessions(reactor_worker_t* worker) {
+    reactor_session_t** link = &worker->graveyard;
+    while (*link != NULL) {
+        reactor_session_t* session = *link;
+
+        pthread_mutex_lock(&session->lock);
+        bool queued = session->tick_queued;
+        pthread_mutex_unlock(&session->lock);
+        if (queued) {
+            link = &session->next;
+            continue;
+        }
+
+        *link = session->next;
+        free_session(session);
+        release_slot(worker->reactor);
+        shard_session_done();
+    }
+}
+
+// Helper private function, drops the tick tasks left in the worker's deque
+static void drop_tasks(reactor_worker_t* worker) {
+    task_t task;
+    while (scheduler_take(worker->reactor->scheduler, worker->index, &task)) {
+        reactor_session_t* session = (reactor_session_t*) task.arg;
+        pthread_mutex_lock(&session->lock);
+        session->tick_queued = false;
+        pthread_mutex_unlock(&session->lock);
+    }
+}
+
+static void* reactor_worker_thread(void* arg) {
+    reactor_worker_t* worker = (reactor_worker_t*) arg;
+    scheduler_t* scheduler = worker->reactor->scheduler;
+    struct epoll_event events[REACTOR_MAX_EVENTS];
+    unsigned long long last_report = scheduler_now_ns();
+    int ran = 0;
+
+    affinity_pin(affinity_cpu(worker->index));
+
+    while (!atomic_load(&worker->reactor->shutdown)) {
+        // only block when the last round of tasks left nothing behind
+        int timeout = (ran == REACTOR_MAX_EVENTS) ? 0 : -1;
+        unsigned long long wait_start = scheduler_now_ns();
+        atomic_store(&worker->idle, timeout < 0);
+        int n = epoll_wait(worker->epoll_fd, events, REACTOR_MAX_EVENTS, timeout);
+        atomic_store(&worker->idle, false);
+        scheduler_add_idle(scheduler, worker->index, scheduler_now_ns() - wait_start);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            perror("epoll_wait");
+            break;
+        }
+
+        for (int i = 0; i < n; i++) {
+            reactor_handle_t* handle = (reactor_handle_t*) events[i].data.ptr;
+            if (handle->kind == HANDLE_WAKE) {
+                adopt_inbox(worker);
+                continue;
+            }
+            if (handle->kind == HANDLE_WHEEL) {
+                uint64_t expirations;
+                if (read(worker->wheel_fd, &expirations, sizeof(expirations)) < 0 && errno != EAGAIN) perror("read wheel fd");
+                continue;
+            }
+
+            reactor_session_t* session = handle->session;
+            pthread_mutex_lock(&session->lock);
+            if (session->state != SESSION_CLOSED) {
+                switch (handle->kind) {
+                    case HANDLE_REQUEST:
+                        on_request(worker, session);
+                        break;
+                    case HANDLE_NOTIFICATION:
+                        on_notification(worker, session, events[i].events);
+                        break;
+                    default:
+                        break;
+                }
+            }
+            pthread_mutex_unlock(&session->lock);
+        }
+
+        // every deadline up to now, whatever woke the worker
+        wheel_advance(&worker->wheel, wheel_now(&worker->wheel));
+        ran = scheduler_run(scheduler, worker->index, REACTOR_MAX_EVENTS);
+        bury_sessions(worker);
+        arm_wheel(worker);
+
+        if (worker->index == 0 && scheduler_now_ns() - last_report > SCHEDULER_REPORT_MS * 1000000ULL) {
+            scheduler_report(scheduler);
+            last_report = scheduler_now_ns();
+        }
+    }
+
+    drop_tasks(worker);
+    // when handing off they are sent once every worker stopped
+    while (!atomic_load(&worker->reactor->handing_off) && worker->running != NULL) {
+        reactor_session_t* session = worker->running;
+        pthread_mutex_lock(&session->lock);
+        close_session(worker, session);
+        pthread_mutex_unlock(&session->lock);
+    }
+    // tasks of these sessions may still sit in the deque of a worker that is stopping too
+    while (bury_sessions(worker), worker->graveyard != NULL) {
+        sched_yield();
+    }
+    return NULL;
+}
+
+reactor_t* reactor_create(int n_workers, int max_games, ghost_pool_t* ghost_pool) {
+    reactor_t* reactor = malloc(sizeof(reactor_t));
+    reactor->n_workers = n_workers;
+    reactor->next_worker = 0;
+    atomic_init(&reactor->shutdown, false);
+    atomic_init(&reactor->handing_off, false);
+    reactor->workers = calloc(n_workers, sizeof(reactor_worker_t));
+    reactor->scheduler = scheduler_create(n_workers);
+    reactor->ghost_pool = ghost_pool;
+    pthread_mutex_init(&reactor->backlog_lock, NULL);
+    reactor->free_slots = max_games;
+    reactor->backlog = reactor->backlog_tail = NULL;
+
+    for (int i = 0; i < n_workers; i++) {
+        reactor_worker_t* worker = &reactor->workers[i];
+        worker->index = i;
+        worker->reactor = reactor;
+        atomic_init(&worker->idle, false);
+        worker->next_wake = 0;
+        worker->inbox = NULL;
+        worker->graveyard = NULL;
+        worker->running = NULL;
+        pthread_mutex_init(&worker->inbox_lock, NULL);
+
+        worker->epoll_fd = epoll_create1(0);
+        worker->wake_fd = eventfd(0, EFD_NONBLOCK);
+        worker->wheel_fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK);
+        worker->wheel_armed = -1;
+        wheel_init(&worker->wheel);
+        worker->wake_handle = (reactor_handle_t) {NULL, HANDLE_WAKE};
+        worker->wheel_handle = (reactor_handle_t) {NULL, HANDLE_WHEEL};
+
+        struct epoll_event event;
+        event.events = EPOLLIN;
+        event.data.ptr = &worker->wake_handle;
+        epoll_ctl(worker->epoll_fd, EPOLL_CTL_ADD, worker->wake_fd, &event);
+        event.data.ptr = &worker->wheel_handle;
+        epoll_ctl(worker->epoll_fd, EPOLL_CTL_ADD, worker->wheel_fd, &event);
+
+        pthread_create(&worker->tid, NULL, reactor_worker_thread, worker);
+    }
+
+    debug("Reactor started with %d workers\n", n_workers);
+    return reactor;
+}
+
+// Helper private function, a session for a client that has not connected yet
+static reactor_session_t* new_session(char* client_request_pipe, char* client_notification_pipe) {
+    reactor_session_t* session = calloc(1, sizeof(reactor_session_t));
+    if (session == NULL) return NULL;
+    pthread_mutex_init(&session->lock, NULL);
+    session->state = SESSION_CONNECTING;
+    snprintf(session->client_request_pipe, sizeof(session->client_request_pipe), "%s", client_request_pipe);
+    snprintf(session->client_notification_pipe, sizeof(session->client_notification_pipe), "%s", client_notification_pipe);
+    session->client_request_fd = -1;
+    session->client_notification_fd = -1;
+    arena_init(&session->arena, ARENA_BLOCK_SIZE);
+    session->request_handle = (reactor_handle_t) {session, HANDLE_REQUEST};
+    session->notification_handle = (reactor_handle_t) {session, HANDLE_NOTIFICATION};
+    return session;
+}
+
+// Helper private function, gives a connecting client a slot or puts it in the backlog
+static void admit(reactor_t* reactor, reactor_session_t* session) {
+    pthread_mutex_lock(&reactor->backlog_lock);
+    if (reactor->free_slots <= 0) {
+        debug("Every session slot is taken, %s waits\n", session->client_notification_pipe);
+        session->next = NULL;
+        if (reactor->backlog_tail) reactor->backlog_tail->next = session;
+        else reactor->backlog = session;
+        reactor->backlog_tail = session;
+        pthread_mutex_unlock(&reactor->backlog_lock);
+        return;
+    }
+    reactor->free_slots--;
+    pthread_mutex_unlock(&reactor->backlog_lock);
+
+    dispatch(reactor, session);
+}
+
+void reactor_add_client(reactor_t* reactor, char* client_request_pipe, char* client_notification_pipe) {
+    reactor_session_t* session = new_session(client_request_pipe, client_notification_pipe);
+    if (session == NULL) {
+        debug("Out of memory, dropping the client %s\n", client_notification_pipe);
+        shard_session_done();
+        return;
+    }
+    admit(reactor, session);
+}
+
+// Helper private function, stops every worker and waits for them
+static void stop_workers(reactor_t* reactor) {
+    atomic_store(&reactor->shutdown, true);
+    for (int i = 0; i < reactor->n_workers; i++) {
+        wake_worker(&reactor->workers[i]);
+    }
+    for (int i = 0; i < reactor->n_workers; i++) {
+        pthread_join(reactor->workers[i].tid, NULL);
+    }
+}
+
+// Helper private function, frees a reactor whose workers are stopped
+static void free_reactor(reactor_t* reactor) {
+    for (int i = 0; i < reactor->n_workers; i++) {
+        reactor_worker_t* worker = &reactor->workers[i];
+        while (worker->inbox != NULL) {
+            reactor_session_t* session = worker->inbox;
+            worker->inbox = session->next;
+            free_session(session);
+        }
+        close(worker->epoll_fd);
+        close(worker->wake_fd);
+        close(worker->wheel_fd);
+        pthread_mutex_destroy(&worker->inbox_lock);
+    }
+
+    while (reactor->backlog != NULL) {
+        reactor_session_t* waiting = reactor->backlog;
+        reactor->backlog = waiting->next;
+        free_session(waiting);
+    }
+    scheduler_report(reactor->scheduler);
+    scheduler_destroy(reactor->scheduler);
+    pthread_mutex_destroy(&reactor->backlog_lock);
+    free(reactor->workers);
+    free(reactor);
+}
+
+void reactor_destroy(reactor_t* reactor) {
+    stop_workers(reactor);
+    free_reactor(reactor);
+}
+
+// Helper private function, sends one session to the next server, its client pipes go along as descriptors
+static int send_session(int sock, reactor_session_t* session) {
+    session_record_t record;
+    memset(&record, 0, sizeof(record));
+    record.state = session->state;
+    record.result = session->result;
+    memcpy(record.client_request_pipe, session->client_request_pipe, sizeof(record.client_request_pipe));
+    memcpy(record.client_notification_pipe, session->client_notification_pipe, sizeof(record.client_notification_pipe));
+    record.connect_attempts = session->connect_attempts;
+    // the next server may list other levels, or the same ones in other positions
+    level_t* last_level = session->catalog != NULL ? catalog_level(session->catalog, session->current_level - 1) : NULL;
+    if (last_level != NULL) snprintf(record.last_level, sizeof(record.last_level), "%s", last_level->name);
+    record.accumulated_points = session->accumulated_points;
+    record.seed = session->seed;
+    record.level_loaded = session->level_loaded;
+
+    if (session->state == SESSION_CONNECTING) return handoff_send(sock, &record, sizeof(record), NULL, 0);
+
+    int fds[HANDOFF_MAX_FDS] = {session->client_request_fd, session->client_notification_fd};
+    if (handoff_send(sock, &record, sizeof(record), fds, HANDOFF_MAX_FDS) < 0) return -1;
+    if (tick_save(&session->tick, sock) < 0) return -1;
+    if (session->level_loaded && save_board(&session->board, sock) < 0) return -1;
+    return 0;
+}
+
+// Helper private function, sends the sessions of a list linked by next and frees them
+static int send_waiting(int sock, reactor_session_t* session, bool* failed) {
+    int sent = 0;
+    while (session != NULL) {
+        reactor_session_t* next = session->next;
+        if (!*failed && send_session(sock, session) < 0) *failed = true;
+        if (!*failed) sent++;
+        free_session(session);
+        session = next;
+    }
+    return sent;
+}
+
+int reactor_hand_off(reactor_t* reactor, int sock) {
+    atomic_store(&reactor->handing_off, true);
+    stop_workers(reactor);
+
+    bool failed = false;
+    int sent = send_waiting(sock, reactor->backlog, &failed);
+    reactor->backlog = reactor->backlog_tail = NULL;
+
+    for (int i = 0; i < reactor->n_workers; i++) {
+        reactor_worker_t* worker = &reactor->workers[i];
+        sent += send_waiting(sock, worker->inbox, &failed);
+        worker->inbox = NULL;
+
+        while (worker->running != NULL) {
+            reactor_session_t* session = worker->running;
+            if (!failed && send_session(sock, session) < 0) failed = true;
+            if (!failed) sent++;
+            close_session(worker, session); // only closes the copies of its pipes in this process
+        }
+        bury_sessions(worker);
+    }
+
+    if (failed) {
+        perror("hand off sessions");
+    } else {
+        session_record_t end;
+        memset(&end, 0, sizeof(end));
+        end.state = SESSION_CLOSED;
+        handoff_send(sock, &end, sizeof(end), NULL, 0);
+    }
+
+    debug("Handed %d sessions to the next server\n", sent);
+    free_reactor(reactor);
+    return failed ? -1 : sent;
+}
+
+// Helper private function, rebuilds a session the previous server was playing
+static reactor_session_t* receive_session(reactor_t* reactor, int sock, session_record_t* record, int* fds, int n_fds) {
+    reactor_session_t* session = new_session(record->client_request_pipe, record->client_notification_pipe);
+    if (session == NULL) {
+        for (int i = 0; i < n_fds; i++) {
+            close(fds[i]);
+        }
+        return NULL;
+    }
+    session->result = record->result;
+    session->connect_attempts = record->connect_attempts;
+    session->accumulated_points = record->accumulated_points;
+    session->seed = record->seed;
+    record->last_level[MAX_FILENAME] = '\0';
+    if (record->last_level[0] != '\0') {
+        // the rest of the game plays the levels of this server
+        session->catalog = catalog_acquire();
+        session->current_level = catalog_level_after(session->catalog, record->last_level);
+    }
+    if (record->state == SESSION_CONNECTING) return session;
+
+    if (n_fds != HANDOFF_MAX_FDS) goto fail;
+    session->state = record->state;
+    session->client_request_fd = fds[0];
+    session->client_notification_fd = fds[1];
+    tick_init(&session->tick, fds[0], fds[1], &session->accumulated_points, reactor->ghost_pool);
+    if (tick_restore(&session->tick, sock) < 0) goto fail;
+
+    if (record->level_loaded) {
+        if (restore_board(&session->board, sock, &session->arena) < 0) goto fail;
+        session->level_loaded = true;
+        session->tick.board = &session->board;
+    }
+    return session;
+
+fail:
+    for (int i = 0; i < n_fds; i++) {
+        close(fds[i]);
+    }
+    tick_destroy(&session->tick);
+    free_session(session);
+    return NULL;
+}
+
+int reactor_take_over(reactor_t* reactor, int sock) {
+    int taken = 0;
+    while (true) {
+        session_record_t record;
+        int fds[HANDOFF_MAX_FDS];
+        int n_fds = 0;
+        if (handoff_recv(sock, &record, sizeof(record), fds, &n_fds) < 0) {
+            debug("The previous server stopped halfway through the hand off\n");
+            break;
+        }
+        if (record.state == SESSION_CLOSED) break;
+
+        reactor_session_t* session = receive_session(reactor, sock, &record, fds, n_fds);
+        if (session == NULL) {
+            debug("Could not resume the session of %s\n", record.client_notification_pipe);
+            break; // the rest of the stream cannot be trusted anymore
+        }
+        taken++;
+
+        if (session->state == SESSION_CONNECTING) {
+            admit(reactor, session);
+            continue;
+        }
+        // already playing, it may take this server over max_games until some session ends
+        pthread_mutex_lock(&reactor->backlog_lock);
+        reactor->free_slots--;
+        pthread_mutex_unlock(&reactor->backlog_lock);
+        dispatch(reactor, session);
+    }
+    return taken;
+}
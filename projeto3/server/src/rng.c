@@ -0,0 +1,65 @@
+#include "rng.h"
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <time.h>
+
+static atomic_ullong session_counter = 0;
+static uint64_t base_seed;
+static bool fixed_base = false;
+
+// Helper private function, splitmix64 step used to spread seeds over the whole state
+static uint64_t splitmix64(uint64_t* state) {
+    uint64_t z = (*state += 0x9e3779b97f4a7c15ULL);
+    z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+    z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+    return z ^ (z >> 31);
+}
+
+static inline uint64_t rotl(uint64_t x, int k) {
+    return (x << k) | (x >> (64 - k));
+}
+
+void rng_seed(rng_t* rng, uint64_t seed) {
+    for (int i = 0; i < 4; i++) {
+        rng->s[i] = splitmix64(&seed);
+    }
+}
+
+uint64_t rng_next(rng_t* rng) {
+    uint64_t* s = rng->s;
+    uint64_t result = rotl(s[1] * 5, 7) * 9;
+    uint64_t t = s[1] << 17;
+
+    s[2] ^= s[0];
+    s[3] ^= s[1];
+    s[1] ^= s[2];
+    s[0] ^= s[3];
+    s[2] ^= t;
+    s[3] = rotl(s[3], 45);
+
+    return result;
+}
+
+char rng_direction(rng_t* rng) {
+    char directions[] = {'W', 'S', 'A', 'D'};
+    return directions[rng_next(rng) >> 62]; // top bits are the best ones
+}
+
+void rng_set_base_seed(uint64_t seed) {
+    base_seed = seed;
+    fixed_base = true;
+}
+
+void rng_set_process(int index) {
+    atomic_store(&session_counter, (unsigned long long) index << 32);
+}
+
+uint64_t rng_session_seed() {
+    uint64_t n = atomic_fetch_add(&session_counter, 1);
+    if (fixed_base) return base_seed + n;
+
+    struct timespec ts;
+    clock_gettime(CLOCK_REALTIME, &ts);
+    uint64_t state = (uint64_t) ts.tv_sec * 1000000000ULL + ts.tv_nsec + n * 0x9e3779b97f4a7c15ULL;
+    return splitmix64(&state);
+}
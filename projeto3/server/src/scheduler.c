@@ -0,0 +1,146 @@
+#include "scheduler.h"
+#include "board.h"
+#include <stdlib.h>
+#include <time.h>
+
+unsigned long long scheduler_now_ns() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (unsigned long long) ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+scheduler_t* scheduler_create(int n_workers) {
+    scheduler_t* scheduler = malloc(sizeof(scheduler_t));
+    scheduler->n_workers = n_workers;
+    scheduler->workers = calloc(n_workers, sizeof(scheduler_worker_t));
+
+    for (int i = 0; i < n_workers; i++) {
+        scheduler_worker_t* worker = &scheduler->workers[i];
+        pthread_mutex_init(&worker->lock, NULL);
+        worker->tasks = malloc(SCHEDULER_INITIAL_CAPACITY * sizeof(task_t));
+        worker->capacity = SCHEDULER_INITIAL_CAPACITY;
+        worker->head = 0;
+        atomic_init(&worker->size, 0);
+        atomic_init(&worker->tasks_run, 0);
+        atomic_init(&worker->tasks_stolen, 0);
+        atomic_init(&worker->busy_ns, 0);
+        atomic_init(&worker->idle_ns, 0);
+    }
+    return scheduler;
+}
+
+void scheduler_destroy(scheduler_t* scheduler) {
+    for (int i = 0; i < scheduler->n_workers; i++) {
+        pthread_mutex_destroy(&scheduler->workers[i].lock);
+        free(scheduler->workers[i].tasks);
+    }
+    free(scheduler->workers);
+    free(scheduler);
+}
+
+int scheduler_push(scheduler_t* scheduler, int worker_index, task_t task) {
+    scheduler_worker_t* worker = &scheduler->workers[worker_index];
+
+    pthread_mutex_lock(&worker->lock);
+    int size = atomic_load_explicit(&worker->size, memory_order_relaxed);
+    if (size == worker->capacity) {
+        // unroll the ring into a buffer twice as big
+        task_t* tasks = malloc(2 * worker->capacity * sizeof(task_t));
+        if (tasks == NULL) {
+            pthread_mutex_unlock(&worker->lock);
+            return -1;
+        }
+        for (int i = 0; i < size; i++) {
+            tasks[i] = worker->tasks[(worker->head + i) % worker->capacity];
+        }
+        free(worker->tasks);
+        worker->tasks = tasks;
+        worker->head = 0;
+        worker->capacity *= 2;
+    }
+    worker->tasks[(worker->head + size) % worker->capacity] = task;
+    atomic_store_explicit(&worker->size, size + 1, memory_order_relaxed);
+    pthread_mutex_unlock(&worker->lock);
+
+    return size + 1;
+}
+
+bool scheduler_take(scheduler_t* scheduler, int worker_index, task_t* task) {
+    scheduler_worker_t* worker = &scheduler->workers[worker_index];
+    bool found = false;
+
+    pthread_mutex_lock(&worker->lock);
+    if (atomic_load_explicit(&worker->size, memory_order_relaxed) > 0) {
+        *task = worker->tasks[worker->head];
+        worker->head = (worker->head + 1) % worker->capacity;
+        atomic_fetch_sub_explicit(&worker->size, 1, memory_order_relaxed);
+        found = true;
+    }
+    pthread_mutex_unlock(&worker->lock);
+    return found;
+}
+
+// Helper private function, takes the newest task of another worker
+static bool steal(scheduler_t* scheduler, int thief, task_t* task) {
+    for (int i = 1; i < scheduler->n_workers; i++) {
+        scheduler_worker_t* victim = &scheduler->workers[(thief + i) % scheduler->n_workers];
+
+        // peek without the lock first so idle workers do not hammer busy deques
+        if (atomic_load_explicit(&victim->size, memory_order_relaxed) == 0) continue;
+
+        pthread_mutex_lock(&victim->lock);
+        int size = atomic_load_explicit(&victim->size, memory_order_relaxed);
+        if (size > 0) {
+            atomic_store_explicit(&victim->size, size - 1, memory_order_relaxed);
+            *task = victim->tasks[(victim->head + size - 1) % victim->capacity];
+            pthread_mutex_unlock(&victim->lock);
+            return true;
+        }
+        pthread_mutex_unlock(&victim->lock);
+    }
+    return false;
+}
+
+int scheduler_run(scheduler_t* scheduler, int worker_index, int max_tasks) {
+    scheduler_worker_t* worker = &scheduler->workers[worker_index];
+    int ran = 0;
+
+    while (ran < max_tasks) {
+        task_t task;
+        if (!scheduler_take(scheduler, worker_index, &task)) {
+            if (!steal(scheduler, worker_index, &task)) break;
+            atomic_fetch_add_explicit(&worker->tasks_stolen, 1, memory_order_relaxed);
+        }
+
+        unsigned long long start = scheduler_now_ns();
+        task.run(task.arg);
+        atomic_fetch_add_explicit(&worker->busy_ns, scheduler_now_ns() - start, memory_order_relaxed);
+        atomic_fetch_add_explicit(&worker->tasks_run, 1, memory_order_relaxed);
+        ran++;
+    }
+    return ran;
+}
+
+void scheduler_add_idle(scheduler_t* scheduler, int worker_index, unsigned long long ns) {
+    atomic_fetch_add_explicit(&scheduler->workers[worker_index].idle_ns, ns, memory_order_relaxed);
+}
+
+void scheduler_stats(scheduler_t* scheduler, int worker_index, scheduler_stats_t* stats) {
+    scheduler_worker_t* worker = &scheduler->workers[worker_index];
+    stats->tasks_run = atomic_load_explicit(&worker->tasks_run, memory_order_relaxed);
+    stats->tasks_stolen = atomic_load_explicit(&worker->tasks_stolen, memory_order_relaxed);
+    stats->busy_ns = atomic_load_explicit(&worker->busy_ns, memory_order_relaxed);
+    stats->idle_ns = atomic_load_explicit(&worker->idle_ns, memory_order_relaxed);
+}
+
+void scheduler_report(scheduler_t* scheduler) {
+    for (int i = 0; i < scheduler->n_workers; i++) {
+        scheduler_stats_t stats;
+        scheduler_stats(scheduler, i, &stats);
+
+        unsigned long long total = stats.busy_ns + stats.idle_ns;
+        double utilization = total ? 100.0 * stats.busy_ns / total : 0.0;
+        debug("Worker %d: %.1f%% busy, %lu tasks run, %lu stolen\n",
+              i, utilization, stats.tasks_run, stats.tasks_stolen);
+    }
+}
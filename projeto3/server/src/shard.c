@@ -0,0 +1,152 @@
+#define _DEFAULT_SOURCE // MAP_ANONYMOUS
+#include "shard.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdatomic.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/wait.h>
+
+struct shards {
+    int n_workers;
+    shard_main_t worker_main;
+    void* arg;
+    pid_t* pids; // -1 once the worker was reaped
+    int* dispatch_fds; // write end of the pipe of each worker, -1 while it is down
+    atomic_int* loads; // shared with the workers, sessions handed over and not finished yet
+};
+
+static atomic_int* own_load = NULL; // slot of this process when it is a worker
+static pid_t own_pid = -1; // backups forked by a session must not count it twice
+
+// Helper private function, forks the worker with the given index on a fresh pipe
+static int spawn(shards_t* shards, int index) {
+    int fds[2];
+    if (pipe(fds) < 0) {
+        perror("pipe");
+        return -1;
+    }
+    atomic_store(&shards->loads[index], 0);
+
+    pid_t pid = fork();
+    if (pid < 0) {
+        perror("fork");
+        close(fds[0]);
+        close(fds[1]);
+        return -1;
+    }
+
+    if (pid == 0) {
+        // the other workers must see EOF when the master closes their pipe
+        close(fds[1]);
+        for (int i = 0; i < shards->n_workers; i++) {
+            if (shards->dispatch_fds[i] >= 0) close(shards->dispatch_fds[i]);
+        }
+        own_load = &shards->loads[index];
+        own_pid = getpid();
+        exit(shards->worker_main(index, fds[0], shards->arg));
+    }
+
+    close(fds[0]);
+    shards->pids[index] = pid;
+    shards->dispatch_fds[index] = fds[1];
+    debug("Worker %d started as process %d\n", index, pid);
+    return 0;
+}
+
+// Helper private function, collects the workers that exited since the last call
+static void reap(shards_t* shards) {
+    int status;
+    pid_t pid;
+    while ((pid = waitpid(-1, &status, WNOHANG)) > 0) {
+        for (int i = 0; i < shards->n_workers; i++) {
+            if (shards->pids[i] != pid) continue;
+
+            if (WIFSIGNALED(status)) debug("Worker %d (process %d) killed by signal %d\n", i, pid, WTERMSIG(status));
+            else debug("Worker %d (process %d) exited with %d\n", i, pid, WEXITSTATUS(status));
+            shards->pids[i] = -1;
+            if (shards->dispatch_fds[i] >= 0) {
+                close(shards->dispatch_fds[i]);
+                shards->dispatch_fds[i] = -1;
+            }
+        }
+    }
+}
+
+shards_t* shards_create(int n_workers, shard_main_t worker_main, void* arg) {
+    shards_t* shards = malloc(sizeof(shards_t));
+    shards->n_workers = n_workers;
+    shards->worker_main = worker_main;
+    shards->arg = arg;
+    shards->pids = malloc(n_workers * sizeof(pid_t));
+    shards->dispatch_fds = malloc(n_workers * sizeof(int));
+    shards->loads = mmap(NULL, n_workers * sizeof(atomic_int), PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+    if (shards->loads == MAP_FAILED) {
+        perror("mmap");
+        free(shards->pids);
+        free(shards->dispatch_fds);
+        free(shards);
+        return NULL;
+    }
+
+    int started = 0;
+    for (int i = 0; i < n_workers; i++) {
+        shards->pids[i] = -1;
+        shards->dispatch_fds[i] = -1;
+        atomic_init(&shards->loads[i], 0);
+    }
+    for (int i = 0; i < n_workers; i++) {
+        if (spawn(shards, i) == 0) started++;
+    }
+
+    if (started == 0) {
+        shards_destroy(shards);
+        return NULL;
+    }
+    return shards;
+}
+
+int shards_dispatch(shards_t* shards, const char* record) {
+    reap(shards);
+
+    // a write can still find a worker that died after reap, then the next one is tried
+    for (int attempt = 0; attempt < shards->n_workers; attempt++) {
+        int best = -1;
+        for (int i = 0; i < shards->n_workers; i++) {
+            if (shards->dispatch_fds[i] < 0 && spawn(shards, i) < 0) continue;
+            if (best < 0 || atomic_load(&shards->loads[i]) < atomic_load(&shards->loads[best])) best = i;
+        }
+        if (best < 0) return -1;
+
+        atomic_fetch_add(&shards->loads[best], 1);
+        if (write_full(shards->dispatch_fds[best], record, CONNECT_RECORD_SIZE) == CONNECT_RECORD_SIZE) {
+            return best;
+        }
+
+        debug("Worker %d is gone, its pipe is closed\n", best);
+        atomic_fetch_sub(&shards->loads[best], 1);
+        close(shards->dispatch_fds[best]);
+        shards->dispatch_fds[best] = -1;
+    }
+    return -1;
+}
+
+void shards_destroy(shards_t* shards) {
+    for (int i = 0; i < shards->n_workers; i++) {
+        if (shards->dispatch_fds[i] >= 0) close(shards->dispatch_fds[i]);
+    }
+    for (int i = 0; i < shards->n_workers; i++) {
+        if (shards->pids[i] > 0) waitpid(shards->pids[i], NULL, 0);
+    }
+
+    munmap(shards->loads, shards->n_workers * sizeof(atomic_int));
+    free(shards->pids);
+    free(shards->dispatch_fds);
+    free(shards);
+}
+
+void shard_session_done() {
+    if (own_load != NULL && getpid() == own_pid) {
+        atomic_fetch_sub(own_load, 1);
+    }
+}
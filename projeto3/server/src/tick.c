@@ -0,0 +1,284 @@
+#include "tick.h"
+#include "protocol.h"
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+
+void tick_init(tick_session_t* session, int client_request_fd, int client_notification_fd, int* accumulated_points,
+               ghost_pool_t* ghost_pool) {
+    session->board = NULL;
+    session->client_request_fd = client_request_fd;
+    session->client_notification_fd = client_notification_fd;
+    session->accumulated_points = accumulated_points;
+    session->ghost_pool = ghost_pool;
+    session->ghost_round = NULL;
+    session->tick = 0;
+    session->n_input = 0;
+    session->output = NULL;
+    session->output_size = 0;
+    session->output_capacity = 0;
+    arena_init(&session->output_arena, ARENA_BLOCK_SIZE);
+}
+
+void tick_start_level(tick_session_t* session, board_t* board) {
+    session->board = board;
+    session->tick = 0;
+}
+
+void tick_destroy(tick_session_t* session) {
+    arena_destroy(&session->output_arena);
+    session->output = NULL;
+    session->output_size = session->output_capacity = 0;
+    ghost_round_free(session->ghost_round);
+    session->ghost_round = NULL;
+}
+
+int tick_save(tick_session_t* session, int fd) {
+    if (write_full(fd, &session->tick, sizeof(session->tick)) < 0) return -1;
+    if (write_full(fd, &session->n_input, sizeof(session->n_input)) < 0) return -1;
+    if (write_full(fd, session->input, session->n_input) < 0) return -1;
+    if (write_full(fd, &session->output_size, sizeof(session->output_size)) < 0) return -1;
+    if (write_full(fd, session->output, session->output_size) < 0) return -1;
+    return 0;
+}
+
+// Helper private function, moves the output to a buffer of at least capacity bytes carved from the output arena, -1 if out of memory
+static int grow_output(tick_session_t* session, int capacity) {
+    // whole cache lines, so the buffer is all the arena hands out for it
+    capacity = (capacity + 63) & ~63;
+    char* output = arena_alloc(&session->output_arena, capacity);
+    if (output == NULL) return -1;
+    if (session->output_size > 0) memcpy(output, session->output, session->output_size);
+    session->output = output;
+    session->output_capacity = capacity;
+    return 0;
+}
+
+int tick_restore(tick_session_t* session, int fd) {
+    if (read_full(fd, &session->tick, sizeof(session->tick)) < 0) return -1;
+    if (read_full(fd, &session->n_input, sizeof(session->n_input)) < 0) return -1;
+    if (session->n_input < 0 || session->n_input > TICK_INPUT_SIZE) return -1;
+    if (read_full(fd, session->input, session->n_input) < 0) return -1;
+
+    int output_size;
+    if (read_full(fd, &output_size, sizeof(output_size)) < 0) return -1;
+    if (output_size < 0 || output_size > TICK_MAX_BACKLOG) return -1;
+    if (output_size > 0) {
+        if (grow_output(session, output_size) < 0) return -1;
+        if (read_full(fd, session->output, output_size) < 0) return -1;
+    }
+    session->output_size = output_size;
+    return 0;
+}
+
+int tick_read_requests(tick_session_t* session) {
+    while (session->n_input < TICK_INPUT_SIZE) {
+        ssize_t n = read(session->client_request_fd, session->input + session->n_input, TICK_INPUT_SIZE - session->n_input);
+        if (n > 0) {
+            session->n_input += n;
+            continue;
+        }
+        if (n < 0 && errno == EINTR) continue;
+        if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) return 0;
+        return -1; // error, or every writer is gone
+    }
+    return 0;
+}
+
+// Helper private function, pops one whole request from the input buffer, returns its size or 0 if there is none
+static int next_request(tick_session_t* session, int* op_code, char* command) {
+    if (session->n_input == 0) return 0;
+
+    int size = 1;
+    *op_code = session->input[0] - '0';
+    if (*op_code == OP_CODE_PLAY) {
+        if (session->n_input < 2) return 0; // command still on its way
+        *command = session->input[1];
+        size = 2;
+    }
+
+    session->n_input -= size;
+    memmove(session->input, session->input + size, session->n_input);
+    return size;
+}
+
+// Helper private function, plays at most one client command
+static int tick_pacman(tick_session_t* session) {
+    board_t* board = session->board;
+    int op_code;
+    char command = '\0';
+
+    if (!next_request(session, &op_code, &command)) {
+        if (tick_read_requests(session) < 0) return QUIT_GAME;
+        if (!next_request(session, &op_code, &command)) return CONTINUE_PLAY; // no input this tick
+    }
+
+    if (op_code == OP_CODE_DISCONNECT) {
+        debug("Receiving disconnect message (1 bytes): op=%c\n", '0' + op_code);
+        return QUIT_GAME;
+    }
+    if (op_code != OP_CODE_PLAY) {
+        debug("Ignoring unknown op code %d\n", op_code);
+        return CONTINUE_PLAY;
+    }
+
+    debug("Receiving play message (2 bytes): op=%d command=%c\n", op_code, command);
+
+    // QUIT
+    if (command == 'Q') return QUIT_GAME;
+    // FORK
+    if (command == 'G') return CREATE_BACKUP;
+
+    command_t play;
+    play.command = command;
+    play.turns = 1;
+    play.turns_left = 1;
+
+    int result = move_pacman(board, 0, &play);
+    *session->accumulated_points = board->pacmans[0].points;
+
+    if (result == REACHED_PORTAL || result == LEVEL_CLEARED) return NEXT_LEVEL;
+    if (result == DEAD_PACMAN) return LOAD_BACKUP;
+    return CONTINUE_PLAY;
+}
+
+int tick_advance(tick_session_t* session) {
+    board_t* board = session->board;
+    pacman_t* pacman = &board->pacmans[0];
+    int result = CONTINUE_PLAY;
+
+    // pacman first, at the same cadence its thread would sleep for
+    if (session->tick % (1 + pacman->passo) == 0) {
+        result = tick_pacman(session);
+    }
+
+    // then the ghosts, always by index order so runs are reproducible
+    if (result == CONTINUE_PLAY && session->ghost_pool && board->n_ghosts >= GHOST_POOL_MIN_GHOSTS) {
+        ghost_pool_update(session->ghost_pool, &session->ghost_round, board, session->tick);
+        if (!pacman->alive) result = LOAD_BACKUP;
+    }
+    else if (result == CONTINUE_PLAY) {
+        for (int i = 0; i < board->n_ghosts; i++) {
+            ghost_t* ghost = &board->ghosts[i];
+            if (ghost->n_moves == 0) continue;
+            if (session->tick % (1 + ghost->passo) != 0) continue;
+
+            move_ghost(board, i, ghost_command(board, i));
+        }
+        if (!pacman->alive) result = LOAD_BACKUP;
+    }
+
+    // and last the frame for this tick
+    if (tick_send_frame(session, 0, 0) < 0) result = QUIT_GAME;
+
+    session->tick++;
+    return result;
+}
+
+int tick_send_frame(tick_session_t* session, int victory, int game_over) {
+    int data_size = board_message_size(session->board);
+
+    if (session->output_size + data_size > TICK_MAX_BACKLOG) {
+        debug("Client on %d is not reading its frames\n", session->client_notification_fd);
+        return -1;
+    }
+    if (session->output_size + data_size > session->output_capacity) {
+        int capacity = session->output_size + data_size;
+        if (capacity < 2 * session->output_capacity) capacity = 2 * session->output_capacity;
+        // the buffer outgrown stays in the arena until the output drains
+        if (grow_output(session, capacity) < 0) return -1;
+    }
+
+    board_to_message(session->output + session->output_size, session->board, victory, game_over, *session->accumulated_points);
+    session->output_size += data_size;
+
+    return tick_flush(session) < 0 ? -1 : 0;
+}
+
+int tick_flush(tick_session_t* session) {
+    int written = 0;
+    while (written < session->output_size) {
+        ssize_t n = write(session->client_notification_fd, session->output + written, session->output_size - written);
+        if (n > 0) {
+            written += n;
+            continue;
+        }
+        if (n < 0 && errno == EINTR) continue;
+        if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) break;
+        return -1; // pipe closed
+    }
+
+    session->output_size -= written;
+    if (session->output_size > 0 && written > 0) {
+        memmove(session->output, session->output + written, session->output_size);
+    }
+    else if (session->output_size == 0 && session->output_arena.used > (size_t) session->output_capacity) {
+        // drained, the buffers outgrown go back and the biggest one is carved again from the blocks kept
+        arena_reset(&session->output_arena);
+        session->output = arena_alloc(&session->output_arena, session->output_capacity);
+        if (session->output == NULL) session->output_capacity = 0;
+    }
+    return session->output_size > 0;
+}
+
+int board_message_size(board_t* game_board) {
+    return sizeof(char) + (sizeof(int)*6) + (sizeof(char)* game_board->width * game_board->height);
+}
+
+void board_to_message(char *message, board_t* game_board, int victory, int game_over, int accumulated_points) {
+    int data_size = board_message_size(game_board);
+    char *ptr = message;
+
+    // op_code (1 byte)
+    ptr[0] = (char)('0' + OP_CODE_BOARD); //OP_CODE_BOARD
+    ptr += 1;
+
+    // width
+    memcpy(ptr, &game_board->width, sizeof(int));
+    ptr += sizeof(int);
+
+    // height
+    memcpy(ptr, &game_board->height, sizeof(int));
+    ptr += sizeof(int);
+
+    // tempo
+    memcpy(ptr, &game_board->tempo, sizeof(int));
+    ptr += sizeof(int);
+
+    // victory
+    int vic = victory;
+    memcpy(ptr, &vic, sizeof(int));
+    ptr += sizeof(int);
+
+    // game_over
+    int eg = game_over;
+    memcpy(ptr, &eg, sizeof(int));
+    ptr += sizeof(int);
+
+    // accumulated_points
+    memcpy(ptr, &accumulated_points, sizeof(int));
+    ptr += sizeof(int);
+
+    // board data (width * height bytes), one byte in and one byte out per cell
+    int n_cells = game_board->width * game_board->height;
+    for (int i = 0; i < n_cells; i++) {
+        ptr[i] = cell_glyph(&game_board->board[i]);
+    }
+
+
+    debug("Sending update message to notifications (%d bytes): op=%c width=%d height=%d tempo: %d victory: %d game_over: %d accumulated_points: %d\n", data_size, message[0], game_board->width, game_board->height, game_board->tempo, vic, eg, accumulated_points);
+    // one debug line per row, not one per cell
+    char line[TICK_DEBUG_LINE + 1];
+    for (int lin = 0; lin < game_board->height; lin++) {
+        int col = 0;
+        do {
+            int n = 0;
+            while (col < game_board->width && n < TICK_DEBUG_LINE) {
+                line[n++] = cell_content(&game_board->board[lin * game_board->width + col++]);
+            }
+            line[n] = '\0';
+            debug("%s%s", line, col < game_board->width ? "" : "\n");
+        } while (col < game_board->width);
+    }
+}
@@ -0,0 +1,139 @@
+#include "wheel.h"
+#include <stddef.h>
+#include <string.h>
+#include <time.h>
+
+static unsigned long long monotonic_ns() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (unsigned long long) ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+void wheel_init(timer_wheel_t* wheel) {
+    memset(wheel, 0, sizeof(timer_wheel_t));
+    wheel->base_ns = monotonic_ns();
+}
+
+unsigned long long wheel_now(timer_wheel_t* wheel) {
+    return (monotonic_ns() - wheel->base_ns) / 1000000ULL;
+}
+
+unsigned long long wheel_to_ns(timer_wheel_t* wheel, unsigned long long ms) {
+    return wheel->base_ns + ms * 1000000ULL;
+}
+
+// Helper private function, links a timer at the head of a slot
+static void link_timer(wheel_timer_t** slot, wheel_timer_t* timer) {
+    timer->next = *slot;
+    if (*slot) (*slot)->pprev = &timer->next;
+    *slot = timer;
+    timer->pprev = slot;
+}
+
+static void unlink_timer(wheel_timer_t* timer) {
+    *timer->pprev = timer->next;
+    if (timer->next) timer->next->pprev = timer->pprev;
+    timer->next = NULL;
+    timer->pprev = NULL;
+}
+
+// Helper private function, files a timer in the slot its deadline belongs to
+static void insert_timer(timer_wheel_t* wheel, wheel_timer_t* timer) {
+    // deadlines already gone fire on the next millisecond processed
+    if (timer->expires <= wheel->current) timer->expires = wheel->current + 1;
+
+    unsigned long long delta = timer->expires - wheel->current;
+    if (delta < WHEEL_SIZE) {
+        link_timer(&wheel->inner[timer->expires & WHEEL_MASK], timer);
+    } else if (delta < (unsigned long long) WHEEL_SIZE * WHEEL_OUTER_SIZE) {
+        link_timer(&wheel->outer[(timer->expires >> WHEEL_BITS) & WHEEL_OUTER_MASK], timer);
+    } else {
+        link_timer(&wheel->overflow, timer);
+    }
+}
+
+// Helper private function, moves every timer of a slot down to where it now belongs
+static void cascade(timer_wheel_t* wheel, wheel_timer_t** slot) {
+    wheel_timer_t* timer = *slot;
+    *slot = NULL;
+    while (timer != NULL) {
+        wheel_timer_t* next = timer->next;
+        insert_timer(wheel, timer);
+        timer = next;
+    }
+}
+
+void wheel_schedule(timer_wheel_t* wheel, wheel_timer_t* timer, int delay_ms, int period_ms) {
+    if (timer->pprev) wheel_cancel(wheel, timer);
+
+    timer->expires = wheel_now(wheel) + delay_ms;
+    timer->period = period_ms;
+    insert_timer(wheel, timer);
+    wheel->n_timers++;
+}
+
+void wheel_cancel(timer_wheel_t* wheel, wheel_timer_t* timer) {
+    if (timer->pprev == NULL) return;
+    unlink_timer(timer);
+    wheel->n_timers--;
+}
+
+int wheel_advance(timer_wheel_t* wheel, unsigned long long now) {
+    int fired = 0;
+
+    // nothing to fire on the way, jump straight to now
+    if (wheel->n_timers == 0 && now > wheel->current) wheel->current = now;
+
+    while (wheel->current < now) {
+        unsigned long long tick = ++wheel->current;
+
+        if ((tick & WHEEL_MASK) == 0) {
+            unsigned long long outer_index = (tick >> WHEEL_BITS) & WHEEL_OUTER_MASK;
+            if (outer_index == 0) cascade(wheel, &wheel->overflow);
+            cascade(wheel, &wheel->outer[outer_index]);
+        }
+
+        // detach the slot, callbacks may cancel or re-arm any timer
+        wheel_timer_t* expired = NULL;
+        wheel_timer_t** slot = &wheel->inner[tick & WHEEL_MASK];
+        while (*slot != NULL) {
+            wheel_timer_t* timer = *slot;
+            unlink_timer(timer);
+            link_timer(&expired, timer);
+        }
+
+        while (expired != NULL) {
+            wheel_timer_t* timer = expired;
+            unlink_timer(timer);
+            wheel->n_timers--;
+
+            if (timer->period > 0) {
+                // stay on the grid of deadlines, skipping the ones already gone
+                unsigned long long next = timer->expires + timer->period;
+                if (next <= now) {
+                    unsigned long long late = (now - next) / timer->period + 1;
+                    timer->missed += late;
+                    next += late * timer->period;
+                }
+                timer->expires = next;
+                insert_timer(wheel, timer);
+                wheel->n_timers++;
+            }
+
+            timer->fire(timer);
+            fired++;
+        }
+    }
+    return fired;
+}
+
+long long wheel_next_expiry(timer_wheel_t* wheel) {
+    if (wheel->n_timers == 0) return -1;
+
+    // the outer wheel has to cascade at the end of this turn of the inner one
+    unsigned long long turn_end = (wheel->current | WHEEL_MASK) + 1;
+    for (unsigned long long tick = wheel->current + 1; tick < turn_end; tick++) {
+        if (wheel->inner[tick & WHEEL_MASK] != NULL) return tick;
+    }
+    return turn_end;
+}